@@ -1,14 +1,38 @@
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+
+#include <binder/IBinder.h>
+#include <binder/IInterface.h>
 #include <binder/IMemory.h>
 #include <binder/Parcel.h>
 #include <log/log.h>
 #include <utils/StrongPointer.h>
 
 #include "alloc_fix.h"
+#include "caps_cache.h"
+#include "caps_region.h"
+#include "caps_snapshot.h"
+#include "latency_hist.h"
+#include "scatter_alloc.h"
+#include "wrap_trace.h"
+#include "wrap_util.h"
+#include "wrap_worker_pool.h"
 
 namespace android::Cacao
 {
@@ -19,11 +43,128 @@ namespace android::Cacao
     };
 }
 
+// client 端只有 cacao service 一個對端，arena 共用一組 heap 即可（arena 本身預設關著，見 heap_arena.h）
+struct ClientAllocPolicy : android::AllocPolicyDefaults
+{
+    static constexpr const char *kWho = "CacaoClient::allocMemory";
+    static constexpr bool kArena = true;
+    static constexpr bool kMemfdSwitch = true;
+};
+
+// ---------- super-slow burst 預留 ----------
+// libimageprocessorjni 切 super-slow 時給的是估計的 frame 大小（YUV420）跟張數。
+// 不直接 reserve：先記成 pending，等 CacaoClient::allocMemory 真的出現一筆落在
+// [frameBytes, frameBytes * 5/4]（stride / padding）的要求，確認 frame 是走這條路、也拿到實際大小後，
+// 才在背景照那個大小建 heap 放進 HeapPool 的 reservation；之後同 size 的 allocMemory 直接拿現成的。
+// - heap 剛好是 frame 大小（不進 2 的冪次 size class），總量夾在 HeapPool::kMaxReservedBytes，超過就只 reserve 一部分
+// - reservation 只有 ashmem 後端；wrap_alloc_memfd=1 時 allocMemory 不會拿它
+// - persist.vendor.sony.camera.wrap_burst_prefault=1 時順便 prefault
+// - frames=0 放掉 reservation（也取消還沒觸發的 pending）
+class BurstReservation
+{
+public:
+    static BurstReservation &get()
+    {
+        static BurstReservation *b = new BurstReservation();
+        return *b;
+    }
+
+    int request(uint32_t frameBytes, uint32_t frames)
+    {
+        const uint64_t req = (frames == 0 || frameBytes == 0) ? 0 : (((uint64_t)frameBytes << 32) | frames);
+        // 舊的 reservation 一律先放掉；worker 只有一條，先排 release 再發佈 pending，之後的 build 一定排在它後面
+        mPending.store(0, std::memory_order_release);
+        if (!mWorker->post([] { android::HeapPool::get().releaseReservation(); }))
+            return -EBUSY;
+        mPending.store(req, std::memory_order_release);
+        return 0;
+    }
+
+    // CacaoClient::allocMemory 每次都會呼叫；沒有 pending 時只有一次 load
+    void noteAlloc(uint64_t size)
+    {
+        uint64_t req = mPending.load(std::memory_order_acquire);
+        if (req == 0)
+            return;
+        const uint64_t frameBytes = req >> 32;
+        if (size < frameBytes || size > frameBytes + frameBytes / 4)
+            return;
+        if (!mPending.compare_exchange_strong(req, 0, std::memory_order_acq_rel))
+            return;
+        const uint32_t frames = (uint32_t)req;
+        if (!mWorker->post([req, size, frames] { build(req, (size_t)size, frames); }))
+            android::wrap_trace(wraptrace::kEvBurstReserve, 0, nullptr, req, 0, -EBUSY);
+    }
+
+private:
+    BurstReservation() : mWorker(new android::WrapWorkerPool("cacao-burst", 1, 0)) {}
+
+    static void build(uint64_t req, size_t size, uint32_t frames)
+    {
+        const bool prefault = android::wrap_prop_bool("persist.vendor.sony.camera.wrap_burst_prefault");
+        const size_t reserved = android::HeapPool::get().reserve(size, frames, prefault);
+        android::wrap_trace(wraptrace::kEvBurstReserve, 0, nullptr, req, reserved,
+                            reserved == (uint64_t)size * frames ? 0 : -ENOMEM);
+    }
+
+    std::atomic<uint64_t> mPending{0};
+    android::WrapWorkerPool *mWorker;
+};
+
 __attribute__((visibility("default")))
 android::sp<android::IMemory>
 android::Cacao::CacaoClient::allocMemory(unsigned long size)
 {
-    return android::allocMemory_common(size, "CacaoClient::allocMemory");
+    BurstReservation::get().noteAlloc(size);
+    return android::allocMemory_common<ClientAllocPolicy>(size, __builtin_return_address(0));
+}
+
+namespace android::Cacao
+{
+    // allocMemory 上限（64 MiB）以上的大 buffer：拆成多個 heap 的 scatter list（見 common/scatter_alloc.h）
+    // 成功時 out 依序是每個 chunk（串起來共 total bytes）；回傳 0，或 -ENOMEM（超過預算 / 建 heap 失敗）、-EINVAL
+    // 後端跟 allocMemory 一樣看 wrap_alloc_memfd
+    __attribute__((visibility("default"))) int allocScatter(uint64_t total,
+                                                            std::vector<android::sp<android::IMemory>> *out)
+    {
+        if (!out)
+            return -EINVAL;
+        out->clear();
+        android::ScatterList list;
+        const int r = android::allocScatter_common(total, list, android::alloc_backend_flags(),
+                                                   android::kScatterChunk, __builtin_return_address(0));
+        if (r == 0)
+            out->swap(list.chunks);
+        return r;
+    }
+} // namespace android::Cacao
+
+// trace ring dump：輸出格式見 common/wrap_trace_format.h，用 wrap_trace_decode 解
+extern "C" __attribute__((visibility("default")))
+int libcacao_client_wrapper_trace_dump(int fd)
+{
+    return android::WrapTrace::get().dump(fd);
+}
+
+// 大 allocation prefault 的累計：out 依序 count / bytes / minflt / ns，回傳填了幾個
+extern "C" __attribute__((visibility("default")))
+size_t libcacao_client_wrapper_prefault_stats(uint64_t *out, size_t n)
+{
+    return android::prefault_stats_read(out, n);
+}
+
+// 依 who tag 的 live allocation 統計（文字，一個 tag 一行；欄位見第一行）
+extern "C" __attribute__((visibility("default")))
+int libcacao_client_wrapper_alloc_stats_dump(int fd)
+{
+    return android::AllocStats::get().dump(fd);
+}
+
+// 各 entry point 的 latency 分佈（文字，一行一條 histogram；見 common/latency_hist.h）
+extern "C" __attribute__((visibility("default")))
+int libcacao_client_wrapper_latency_dump(int fd)
+{
+    return android::LatencyStats::get().dump(fd);
 }
 
 namespace cacao
@@ -37,13 +178,10 @@ namespace cacao
 
 namespace android
 {
-    struct ICacaoService; // 不需要完整定義
-}
-
-// ---------- vtable helper ----------
-static inline void **Vtbl(void *obj)
-{
-    return *reinterpret_cast<void ***>(obj);
+    // 只需要知道它是 IInterface（拿 binder 做 linkToDeath、sp<> 要能 incStrong），其他不需要定義
+    struct ICacaoService : public IInterface
+    {
+    };
 }
 
 // cacao::Caps vtable slots（依你反編譯：+0x20/+0x28/+0x30）
@@ -51,11 +189,433 @@ using CapsSizeFn = uint64_t (*)(cacao::Caps *self);     // slot 4
 using CapsPrepFn = int (*)(cacao::Caps *self, void *);  // slot 5
 using CapsFinalFn = int (*)(cacao::Caps *self, void *); // slot 6
 
+// service getCaps 的最後一個參數是值傳的 cacao::ISerialize::SerializedData（大小的依據見 server wrapper）
+// - arm64：0x198，超過 16 bytes 的值傳 struct 由 caller 複製一份傳指標；reply 就是那份複本，直接傳指標
+// - arm：0x194，r3 + stack 值傳；傳指標的話 service 會把指標當第一個 word、stack 上的垃圾當其餘內容
+#if defined(__LP64__)
+using CapsWireArg = void *;
+static inline CapsWireArg caps_wire_arg(uint8_t *reply) { return reply; }
+#else
+struct CapsWireBlob
+{
+    alignas(4) uint8_t bytes[0x194];
+};
+using CapsWireArg = CapsWireBlob;
+static inline CapsWireArg caps_wire_arg(uint8_t *reply)
+{
+    CapsWireBlob b;
+    memcpy(b.bytes, reply, sizeof(b.bytes));
+    return b;
+}
+#endif
+
 // service vtable slot（依你反編譯：*mService +0x30）
 using SvcGetCapsFn = int (*)(android::ICacaoService *svc,
                              const cacao::ProcessCtrlCaps::CameraIndex &idx,
                              android::sp<android::IMemory> *mem,
-                             void *blob198);
+                             CapsWireArg blob);
+
+// ---------- typed vtable dispatch ----------
+// 每個 build 一份 ABI descriptor：slot 的 byte offset（arm64 是反編譯看到的值，arm 是同一個 slot 編號 x 4）
+// static_assert 對過 slot 編號，改錯 offset 編不過
+struct CapsAbi
+{
+    static constexpr const char *kName = "cacao::Caps";
+#if defined(__LP64__)
+    static constexpr size_t kSizeOff = 0x20;
+    static constexpr size_t kPrepOff = 0x28;
+    static constexpr size_t kFinalOff = 0x30;
+#else
+    static constexpr size_t kSizeOff = 0x10;
+    static constexpr size_t kPrepOff = 0x14;
+    static constexpr size_t kFinalOff = 0x18;
+#endif
+    static constexpr size_t kEndOff = kFinalOff + sizeof(void *);
+
+    struct Fns
+    {
+        CapsSizeFn size;
+        CapsPrepFn prepare;
+        CapsFinalFn finalize;
+    };
+
+    static void load(void *const *vt, Fns &f)
+    {
+        f.size = reinterpret_cast<CapsSizeFn>(vt[kSizeOff / sizeof(void *)]);
+        f.prepare = reinterpret_cast<CapsPrepFn>(vt[kPrepOff / sizeof(void *)]);
+        f.finalize = reinterpret_cast<CapsFinalFn>(vt[kFinalOff / sizeof(void *)]);
+    }
+
+    static bool valid(const Fns &f, bool (*code)(const void *))
+    {
+        return code(reinterpret_cast<const void *>(f.size)) && code(reinterpret_cast<const void *>(f.prepare)) &&
+               code(reinterpret_cast<const void *>(f.finalize));
+    }
+};
+static_assert(CapsAbi::kSizeOff == 4 * sizeof(void *) && CapsAbi::kPrepOff == 5 * sizeof(void *) &&
+                  CapsAbi::kFinalOff == 6 * sizeof(void *),
+              "cacao::Caps slot offsets do not match slots 4/5/6");
+
+struct SvcAbi
+{
+    static constexpr const char *kName = "ICacaoService";
+#if defined(__LP64__)
+    static constexpr size_t kGetCapsOff = 0x30;
+#else
+    static constexpr size_t kGetCapsOff = 0x18;
+#endif
+    static constexpr size_t kEndOff = kGetCapsOff + sizeof(void *);
+
+    struct Fns
+    {
+        SvcGetCapsFn getCaps;
+    };
+
+    static void load(void *const *vt, Fns &f)
+    {
+        f.getCaps = reinterpret_cast<SvcGetCapsFn>(vt[kGetCapsOff / sizeof(void *)]);
+    }
+
+    static bool valid(const Fns &f, bool (*code)(const void *))
+    {
+        return code(reinterpret_cast<const void *>(f.getCaps));
+    }
+};
+static_assert(SvcAbi::kGetCapsOff == 6 * sizeof(void *), "ICacaoService getCaps offset does not match slot 6");
+
+// 位址落在某個已載入 object 的範圍內（dladdr 只查 linker 的表，不碰該位址本身）
+static bool vtable_addr_loaded(const void *p)
+{
+    Dl_info info;
+    return p != nullptr && dladdr(p, &info) != 0 && info.dli_fbase != nullptr;
+}
+
+// 依 dynamic type（vptr）解析一次、之後直接用快取的 function pointer
+// - 快取是只增不減的 linked list（一個 type 一個 node，leak），讀不用 lock
+// - layout 不對（vptr / slot 不在任何已載入 object 裡）時記一次 log，也快取成「壞的」，之後直接回 nullptr
+// caller 拿到 nullptr 要回錯誤碼，不要呼叫
+template <typename Abi>
+class VtableDispatch
+{
+public:
+    static const typename Abi::Fns *resolve(const void *obj)
+    {
+        if (!obj)
+            return nullptr;
+        void *const *vt = *reinterpret_cast<void *const *const *>(obj);
+        for (const Entry *e = head().load(std::memory_order_acquire); e; e = e->next)
+        {
+            if (e->vptr == vt)
+                return e->ok ? &e->fns : nullptr;
+        }
+        return resolveSlow(vt);
+    }
+
+private:
+    struct Entry
+    {
+        void *const *vptr;
+        bool ok;
+        typename Abi::Fns fns;
+        const Entry *next;
+    };
+
+    static std::atomic<const Entry *> &head()
+    {
+        static std::atomic<const Entry *> h{nullptr};
+        return h;
+    }
+
+    static const typename Abi::Fns *resolveSlow(void *const *vt)
+    {
+        static std::mutex lock;
+        std::lock_guard<std::mutex> _l(lock);
+        const Entry *first = head().load(std::memory_order_acquire);
+        for (const Entry *e = first; e; e = e->next)
+        {
+            if (e->vptr == vt)
+                return e->ok ? &e->fns : nullptr;
+        }
+
+        Entry *e = new Entry();
+        e->vptr = vt;
+        e->ok = false;
+        e->fns = typename Abi::Fns();
+        // vtable 頭尾都要在已載入的 object 裡，才去讀 slot
+        if (vtable_addr_loaded(vt) && vtable_addr_loaded(reinterpret_cast<const char *>(vt) + Abi::kEndOff - 1))
+        {
+            Abi::load(vt, e->fns);
+            e->ok = Abi::valid(e->fns, vtable_addr_loaded);
+        }
+        if (!e->ok)
+            ALOGE("WRAP: unexpected %s vtable layout vptr=%p, refusing dispatch", Abi::kName, vt);
+        e->next = first;
+        head().store(e, std::memory_order_release);
+        return e->ok ? &e->fns : nullptr;
+    }
+};
+
+static constexpr size_t kCapsBlobSize = 0x198;
+
+// SerializedData 裡跟 shared memory 有關的欄位（依 real Cacao::getCaps 反編譯）：
+// prepare 之前 +388 填 IMemory::size()、+392 填 IMemory::pointer()，prepare / finalize 都經過這個指標讀寫 payload；
+// service 成功後、finalize 之前把緊接著的 8 bytes 清 0（arm64 +400，arm +396）
+struct CapsBlobLayout
+{
+    static constexpr size_t kMemSizeOff = 388;
+    static constexpr size_t kMemPtrOff = 392;
+    static constexpr size_t kResultOff = kMemPtrOff + sizeof(void *);
+    static constexpr size_t kResultLen = 8;
+};
+static_assert(CapsBlobLayout::kResultOff + CapsBlobLayout::kResultLen <= kCapsBlobSize, "caps blob layout overflow");
+
+static inline void caps_blob_attach(uint8_t *blob, const android::sp<android::IMemory> &mem)
+{
+    const uint32_t size = (uint32_t)mem->size();
+    void *ptr = mem->unsecurePointer();
+    memcpy(blob + CapsBlobLayout::kMemSizeOff, &size, sizeof(size));
+    memcpy(blob + CapsBlobLayout::kMemPtrOff, &ptr, sizeof(ptr));
+}
+
+static inline void caps_blob_clear_result(uint8_t *blob)
+{
+    memset(blob + CapsBlobLayout::kResultOff, 0, CapsBlobLayout::kResultLen);
+}
+
+// caps vtable size 的回傳值：ILP32 上高 32 bit 是 r1 的殘值（原本 cast 成 unsigned long 時丟掉），
+// 照原行為截掉，免得污染快取 / snapshot 的 key
+static inline uint64_t caps_raw_size(uint64_t v)
+{
+#if defined(__LP64__)
+    return v;
+#else
+    return (uint32_t)v;
+#endif
+}
+
+// CameraIndex 只有前向宣告；real.so 裡是包一個 int 的 struct，取前 4 bytes 當 key
+static inline int32_t camera_index_key(const cacao::ProcessCtrlCaps::CameraIndex &idx)
+{
+    int32_t v = 0;
+    memcpy(&v, &idx, sizeof(v));
+    return v;
+}
+
+// 跨 thread 用的 CameraIndex 複本（同上，只保留前 4 bytes，其餘補 0）
+struct CameraIndexStorage
+{
+    alignas(8) int32_t words[2] = {0, 0};
+
+    explicit CameraIndexStorage(int32_t key) { words[0] = key; }
+
+    const cacao::ProcessCtrlCaps::CameraIndex &ref() const
+    {
+        return *reinterpret_cast<const cacao::ProcessCtrlCaps::CameraIndex *>(words);
+    }
+};
+
+// getCaps 結果快取（common/caps_cache.h）
+using android::CapsCache;
+static_assert(CapsCache::kBlobSize == kCapsBlobSize, "CapsCache blob size mismatch");
+
+// ---------- getCaps on-disk snapshot ----------
+// 每個 (CameraIndex, raw) 的 service 結果（reply + shared memory 內容）存一份到 CameraApp data dir，
+// 另外看 ro.build.fingerprint（見 common/caps_snapshot.h）。
+// cold start（這個 process 還沒真的連上 service）時命中就把 reply / payload 寫回 exchange 再 finalize，
+// 同時背景 thread 連 service 拿 live 結果跟 snapshot 比對，不同就重寫檔案（見 verify_snapshot_in_background）。
+// - prepare 出來的 blob 帶著這個 process 的 mem 指標，不能當 key；reply 裡的指標欄位存檔前清掉
+// - payload 大小跟這次的 mem 不同就不用（caller 當 miss）
+// - 路徑可用 persist.vendor.sony.camera.wrap_caps_snapshot_path 指定
+// - persist.vendor.sony.camera.wrap_caps_snapshot=0 可關掉
+class CapsSnapshotStore
+{
+public:
+    static CapsSnapshotStore &get()
+    {
+        static CapsSnapshotStore *s = new CapsSnapshotStore();
+        return *s;
+    }
+
+    static bool enabled()
+    {
+        static const bool on = android::wrap_prop_long("persist.vendor.sony.camera.wrap_caps_snapshot", 1) != 0;
+        return on;
+    }
+
+    bool lookup(int32_t index, uint64_t raw, CapsCache::Result *out)
+    {
+        std::lock_guard<std::mutex> _l(mLock);
+        loadLocked();
+        const Owned *o = findLocked(index, raw);
+        if (!o)
+            return false;
+        memcpy(out->reply, o->reply.data(), kCapsBlobSize);
+        out->payload = o->payload;
+        return true;
+    }
+
+    bool contains(int32_t index, uint64_t raw)
+    {
+        std::lock_guard<std::mutex> _l(mLock);
+        loadLocked();
+        return findLocked(index, raw) != nullptr;
+    }
+
+    struct Known
+    {
+        int32_t index;
+        uint64_t raw;
+    };
+
+    // snapshot 裡記過的 (CameraIndex, raw)，給 prefetch 用
+    std::vector<Known> known()
+    {
+        std::lock_guard<std::mutex> _l(mLock);
+        loadLocked();
+        std::vector<Known> out;
+        for (const Owned &o : mRecords)
+            out.push_back(Known{o.index, o.raw});
+        return out;
+    }
+
+    // live service 的結果；跟目前內容一樣就什麼都不做，不同才在背景重寫
+    void update(int32_t index, uint64_t raw, const uint8_t *reply, const android::sp<android::IMemory> &payload)
+    {
+        const uint8_t *pp = payload != nullptr ? static_cast<const uint8_t *>(payload->unsecurePointer()) : nullptr;
+        const size_t psz = pp ? payload->size() : 0;
+        if (psz > android::CapsSnapshot::kMaxPayload)
+            return;
+
+        alignas(8) uint8_t portable[kCapsBlobSize];
+        memcpy(portable, reply, kCapsBlobSize);
+        memset(portable + CapsBlobLayout::kMemPtrOff, 0, sizeof(void *));
+
+        std::lock_guard<std::mutex> _l(mLock);
+        loadLocked();
+        if (mPath.empty())
+            return;
+
+        Owned *slot = findLocked(index, raw);
+        if (slot && memcmp(slot->reply.data(), portable, kCapsBlobSize) == 0 && slot->payload.size() == psz &&
+            (psz == 0 || memcmp(slot->payload.data(), pp, psz) == 0))
+            return;
+
+        if (!slot)
+        {
+            if (mRecords.size() >= android::CapsSnapshot::kMaxEntries)
+                return;
+            mRecords.emplace_back();
+            slot = &mRecords.back();
+            slot->index = index;
+            slot->raw = raw;
+        }
+        slot->reply.assign(portable, portable + kCapsBlobSize);
+        slot->payload.assign(pp, pp + psz);
+
+        WriteJob *job = new (std::nothrow) WriteJob{mPath, mFingerprint, mRecords};
+        if (!job)
+            return;
+        pthread_t t;
+        if (pthread_create(&t, nullptr, writeThreadMain, job) == 0)
+            pthread_detach(t);
+        else
+            delete job;
+    }
+
+private:
+    struct Owned
+    {
+        int32_t index;
+        uint64_t raw;
+        std::vector<uint8_t> reply;
+        std::vector<uint8_t> payload;
+    };
+
+    struct WriteJob
+    {
+        std::string path;
+        std::string fingerprint;
+        std::vector<Owned> records;
+    };
+
+    CapsSnapshotStore() = default;
+
+    Owned *findLocked(int32_t index, uint64_t raw)
+    {
+        for (Owned &o : mRecords)
+        {
+            if (o.index == index && o.raw == raw)
+                return &o;
+        }
+        return nullptr;
+    }
+
+    void loadLocked()
+    {
+        if (mLoadAttempted)
+            return;
+        mLoadAttempted = true;
+
+        char path[PROP_VALUE_MAX] = {0};
+        if (android::wrap_prop_get("persist.vendor.sony.camera.wrap_caps_snapshot_path", path) > 0)
+        {
+            mPath = path;
+        }
+        else
+        {
+            const std::string dir = android::get_camera_data_dir();
+            if (dir.empty())
+                return;
+            const std::string nb = dir + "/no_backup";
+            if (access(nb.c_str(), F_OK) != 0 && mkdir(nb.c_str(), 0700) != 0)
+                return;
+            mPath = nb + "/cacao_caps.snap";
+        }
+        mFingerprint = android::get_build_fingerprint();
+
+        // 內容全部複製出來，檔案馬上 unmap（之後背景重寫會 rename 蓋掉）
+        android::CapsSnapshot snap;
+        if (!snap.open(mPath, mFingerprint))
+            return;
+        for (uint32_t i = 0; i < snap.count(); i++)
+        {
+            const android::CapsSnapshot::Entry *e = snap.entryAt(i);
+            const uint8_t *pp = static_cast<const uint8_t *>(snap.payloadOf(e));
+            Owned o;
+            o.index = e->index;
+            o.raw = e->raw;
+            o.reply.assign(e->reply, e->reply + kCapsBlobSize);
+            o.payload.assign(pp, pp + e->payload_size);
+            mRecords.push_back(std::move(o));
+        }
+    }
+
+    static void *writeThreadMain(void *arg)
+    {
+        WriteJob *job = static_cast<WriteJob *>(arg);
+        std::vector<android::CapsSnapshot::Record> recs;
+        for (const Owned &o : job->records)
+        {
+            recs.push_back(
+                android::CapsSnapshot::Record{o.index, o.raw, o.reply.data(), o.payload.data(), o.payload.size()});
+        }
+        // 同時只有一個 writer，後寫的蓋掉先寫的
+        static std::mutex writeLock;
+        {
+            std::lock_guard<std::mutex> _l(writeLock);
+            if (!android::CapsSnapshot::write(job->path, job->fingerprint, recs))
+                ALOGE("WRAP: caps snapshot write failed path=%s", job->path.c_str());
+        }
+        delete job;
+        return nullptr;
+    }
+
+    std::mutex mLock;
+    bool mLoadAttempted = false;
+    std::string mPath;
+    std::string mFingerprint;
+    std::vector<Owned> mRecords;
+};
 
 namespace android::Cacao
 {
@@ -65,56 +625,713 @@ namespace android::Cacao
     extern int mServicePid;
     int getService();
 
-    __attribute__((visibility("default"))) int getCaps(const cacao::ProcessCtrlCaps::CameraIndex &idx,
-                                                       cacao::Caps *caps)
+    // 這個 process 裡 getService() 有沒有成功過；沒有就算 cold start
+    static std::atomic<bool> sServiceSeen{false};
+
+    // ---------- 快取的 service handle ----------
+    // 原本每次 getCaps 都 getService() 再看 mService / mServicePid。
+    // 改成解一次就把 (svc, pid) 發佈出去，快路徑只有一次 acquire load；
+    // binder 死掉時 DeathRecipient 把發佈的 handle 拿掉，下一個 caller 在 mutex 下重解一次，
+    // 其他同時進來的 caller 等它解完直接用結果。
+    // 交出去的 svc 一律在 wrapper 這邊留一個 strong ref 不放（service 重啟次數很少），
+    // 避免快路徑剛 load 到的指標被 death 通知的那條 thread 或 real.so 換掉 mService 時釋放掉。
+    class ServiceHandle
     {
-        // 保持與原邏輯一致：確保 service 初始化
-        getService();
+    public:
+        static ServiceHandle &get()
+        {
+            static ServiceHandle *h = new ServiceHandle();
+            return *h;
+        }
+
+        android::ICacaoService *acquire()
+        {
+            const Published *p = mPublished.load(std::memory_order_acquire);
+            if (p && p->pid == (int)getpid())
+                return p->svc;
+            return resolveSlow();
+        }
+
+    private:
+        struct Published
+        {
+            android::ICacaoService *svc;
+            int pid;
+        };
+
+        class Death : public android::IBinder::DeathRecipient
+        {
+        public:
+            void binderDied(const android::wp<android::IBinder> &) override { ServiceHandle::get().onDied(); }
+        };
+
+        ServiceHandle() = default;
+
+        android::ICacaoService *resolveSlow()
+        {
+            std::lock_guard<std::mutex> _l(mLock);
+            const int pid = (int)getpid();
+            const Published *p = mPublished.load(std::memory_order_acquire);
+            if (p && p->pid == pid)
+                return p->svc;
 
-        if (mService == nullptr)
-            return 0;
-        if (mServicePid != (int)getpid())
-            return 0;
-        if (!caps)
-            return -0x67;
+            // 保持與原邏輯一致：確保 service 初始化
+            // mService 是 real.so 自己的 global（有它自己的 lock）：只讀一次拷成 strong ref，之後都用這份，
+            // 不改寫它；死掉的 proxy 交給 real.so 的 getService() 自己處理
+            getService();
+            android::sp<android::ICacaoService> svc = mService;
+            const int svcPid = mServicePid;
+            if (svc == nullptr)
+                return nullptr;
+            sServiceSeen.store(true, std::memory_order_release);
+            if (svcPid != pid)
+                return nullptr;
+            keepAliveLocked(svc);
+
+            // 已經死掉的 proxy：照原邏輯用它（呼叫會失敗），但不發佈，下一次再走 slow path
+            android::sp<android::IBinder> binder = android::IInterface::asBinder(svc.get());
+            if (binder != nullptr && !binder->isBinderAlive())
+                return svc.get();
+
+            if (mDeath == nullptr)
+                mDeath = new Death();
+            if (binder != nullptr)
+                binder->linkToDeath(mDeath);
+
+            Published *np = new (std::nothrow) Published{svc.get(), pid};
+            if (!np)
+                return svc.get();
+            mAllPublished.push_back(np);
+            mPublished.store(np, std::memory_order_release);
+            return np->svc;
+        }
+
+        // 交出去的 svc 都留一個 strong ref（同一個只留一次）
+        void keepAliveLocked(const android::sp<android::ICacaoService> &svc)
+        {
+            for (const auto &k : mKeepAlive)
+            {
+                if (k == svc)
+                    return;
+            }
+            mKeepAlive.push_back(svc);
+        }
+
+        void onDied()
+        {
+            mPublished.store(nullptr, std::memory_order_release);
+            CapsCache::get().invalidate();
+        }
+
+        std::mutex mLock;
+        std::atomic<const Published *> mPublished{nullptr};
+        android::sp<Death> mDeath;
+        std::vector<android::sp<android::ICacaoService>> mKeepAlive;
+        std::vector<Published *> mAllPublished;
+    };
+
+    // ---------- 跨 process caps 區塊（見 common/caps_region.h）----------
+    // service 端的 wrapper 在 CacaoService::getCaps 裡發佈 payload；這邊第一次用到時唯讀 map，
+    // 之後 (CameraIndex, mem 大小) 相符就把 payload 複製進 mem 再 finalize，不走 binder；
+    // service 端還沒建檔時每 5 秒最多重試一次
+    static const android::CapsRegion *caps_region_reader()
+    {
+        static std::atomic<const android::CapsRegion *> region{nullptr};
+        static std::atomic<int64_t> lastAttemptNs{0};
+        static std::mutex lock;
+
+        const android::CapsRegion *r = region.load(std::memory_order_acquire);
+        if (r)
+            return r;
+        if (!android::CapsRegion::enabled())
+            return nullptr;
+
+        const int64_t now = android::wrap_now_ns();
+        const int64_t last = lastAttemptNs.load(std::memory_order_relaxed);
+        if (last != 0 && now - last < 5LL * 1000000000LL)
+            return nullptr;
+
+        std::lock_guard<std::mutex> _l(lock);
+        if ((r = region.load(std::memory_order_acquire)) != nullptr)
+            return r;
+        lastAttemptNs.store(now, std::memory_order_relaxed);
+        android::CapsRegion *nr = new (std::nothrow) android::CapsRegion();
+        if (!nr)
+            return nullptr;
+        if (!nr->openReader(android::CapsRegion::path(), android::get_build_fingerprint()))
+        {
+            delete nr;
+            return nullptr;
+        }
+        region.store(nr, std::memory_order_release);
+        return nr;
+    }
+
+    // getCaps 的 buffer：太小拉到 blob 大小。
+    // heap 來自跟一般 client allocation 共用的 pool / arena，上一個使用者的資料可能還在；
+    // service 不一定寫滿整塊，所以照原本（每次新的 heap，全 0）清掉再交出去
+    struct CapsAllocPolicy : android::AllocPolicyDefaults
+    {
+        static constexpr const char *kWho = "Cacao::getCaps";
+        static constexpr unsigned long kClampMin = kCapsBlobSize;
+        static constexpr uint16_t kTraceFlags = wraptrace::kFlagCapsPath;
+        static constexpr bool kArena = true;
+    };
+
+    // ---------- per-camera caps exchange buffer ----------
+    // 原本每次 getCaps：stack 上兩塊 0x198（buf_1f0 / buf_388）+ 一個新的 shared-memory heap。
+    // 改成每個 CameraIndex 一份常駐的 exchange：
+    // - prepared / reply：prepare 直接寫進 prepared，service 直接寫 reply；getCaps 期間持有 lock
+    //   （service 會就地改 blob，finalize 跟快取 key 又要原本的 prepared，所以 prepared -> reply 這一次 copy 省不掉）
+    // - mem：同一個 IMemory 每次重用，service 那邊拿到的是同一個 heap，HeapCache 的 mapping 也一直留著。
+    //   用 take / give 借出（CapsMemLease），deadline worker 比 caller 活得久也沒關係；被借走時就另外 alloc 一個
+    // prepared 裡記著 mem 的指標（caps_blob_attach），finalize 從 mem 讀 service 填的 payload；
+    // 不走 service 的路徑（快取等）要先把 reply / payload 寫回這裡才 finalize
+    struct CapsExchange
+    {
+        std::mutex lock;
+        alignas(8) uint8_t prepared[kCapsBlobSize];
+        alignas(8) uint8_t reply[kCapsBlobSize];
+
+        std::mutex memLock;
+        android::sp<android::IMemory> mem;
+        uint64_t memRaw = 0;
+
+        android::sp<android::IMemory> takeMem(uint64_t raw)
+        {
+            std::lock_guard<std::mutex> _l(memLock);
+            android::sp<android::IMemory> m;
+            if (mem != nullptr && memRaw == raw)
+            {
+                m = mem;
+                mem.clear();
+            }
+            return m;
+        }
+
+        void giveMem(uint64_t raw, const android::sp<android::IMemory> &m)
+        {
+            std::lock_guard<std::mutex> _l(memLock);
+            if (mem == nullptr || memRaw != raw)
+            {
+                mem = m;
+                memRaw = raw;
+            }
+        }
+    };
+
+    // getCaps 期間借 exchange 的 mem，結束時還回去；交給還沒回來的 deadline worker 時先 clear，不還
+    // 重用的 heap 裡是上一次的 payload，照新 alloc 的樣子清成 0
+    struct CapsMemLease
+    {
+        CapsExchange &ex;
+        uint64_t raw;
+        android::sp<android::IMemory> mem;
+
+        CapsMemLease(CapsExchange &e, uint64_t r) : ex(e), raw(r), mem(e.takeMem(r))
+        {
+            // 用你的 allocator 修正 raw（避免 &0xffffffff / sign-extend）
+            if (mem == nullptr)
+                mem = android::allocMemory_common<CapsAllocPolicy>(r);
+            else if (void *p = mem->unsecurePointer())
+                memset(p, 0, mem->size());
+        }
+
+        ~CapsMemLease()
+        {
+            if (mem != nullptr)
+                ex.giveMem(raw, mem);
+        }
+    };
+
+    // 故意 leak（跟其他 singleton 一樣）；camera 數量很少
+    static CapsExchange &caps_exchange(int32_t key)
+    {
+        static std::mutex lock;
+        static std::vector<std::pair<int32_t, CapsExchange *>> *all =
+            new std::vector<std::pair<int32_t, CapsExchange *>>();
+        std::lock_guard<std::mutex> _l(lock);
+        for (const auto &kv : *all)
+        {
+            if (kv.first == key)
+                return *kv.second;
+        }
+        CapsExchange *ex = new CapsExchange();
+        all->emplace_back(key, ex);
+        return *ex;
+    }
+
+    // service vtable +0x30，成功就寫進快取 / snapshot；回傳 0、-0x6e 或 -0x6f
+    // prepared 是 prepare 寫出的 blob（已 attach 到 mem），不會被改；reply 是 caller 給的 scratch（service 就地寫）
+    static int fetch_caps_from_service(android::ICacaoService *svc, const cacao::ProcessCtrlCaps::CameraIndex &idx,
+                                       uint64_t raw, const uint8_t *prepared, uint8_t *reply,
+                                       const android::sp<android::IMemory> &mem)
+    {
+        const int32_t key = camera_index_key(idx);
+
+        // 呼叫 service vtable +0x30
+        const SvcAbi::Fns *sv = VtableDispatch<SvcAbi>::resolve(svc);
+        if (!sv)
+            return -0x6f;
+        if (reply != prepared)
+            memcpy(reply, prepared, kCapsBlobSize);
+        android::sp<android::IMemory> m = mem;
+        int rsvc = sv->getCaps(svc, idx, &m, caps_wire_arg(reply));
+        if (rsvc == -0x6e)
+            return -0x6e;
+        if (rsvc != 0 || m == nullptr)
+            return -0x6f;
+
+        // payload 以 prepared 指到的那塊為準（finalize 讀的也是它）
+        if (CapsCache::enabled())
+            CapsCache::get().store(key, raw, svc, prepared, reply, mem->unsecurePointer(), mem->size());
+        if (CapsSnapshotStore::enabled())
+            CapsSnapshotStore::get().update(key, raw, reply, mem);
+        return 0;
+    }
+
+    // 快取等不走 service 的結果寫回 exchange（原本 service 寫的 buf_388 跟 mem）；
+    // payload 大小跟這次的 mem 不同就不能用，回 false 讓 caller 當 miss
+    static bool replay_caps(uint8_t *reply, const android::sp<android::IMemory> &mem, const uint8_t *savedReply,
+                            const std::vector<uint8_t> &payload)
+    {
+        void *p = mem->unsecurePointer();
+        if (!p || payload.size() != mem->size())
+            return false;
+        memcpy(reply, savedReply, kCapsBlobSize);
+        memcpy(p, payload.data(), payload.size());
+        return true;
+    }
+
+    // caps vtable +0x30：finalize/commit（照 real 先清掉 service 之後的那 8 bytes）
+    static int finalize_caps(const CapsAbi::Fns *cv, cacao::Caps *caps, uint8_t *prepared)
+    {
+        caps_blob_clear_result(prepared);
+        return android::latency_real([&] { return cv->finalize(caps, prepared); });
+    }
+
+    // ---------- deadline ----------
+    // service 卡住時 vtable +0x30 的 binder call 會一直等，UI thread 跟著卡。
+    // 有 last-known-good 可退的時候，把 service call 丟到 worker 上，最多等
+    // persist.vendor.sony.camera.wrap_caps_deadline_ms（預設 1000，0 = 不限）；
+    // 超時就把 last-known-good 的 reply / payload 寫進一塊新的 mem 再 finalize，並累加 timeout 計數；
+    // 到那時 last-known-good 不見了（或 payload 大小對不上）就回 -0x6f，不拿沒填的 payload 去 finalize。
+    // 同一個 (CameraIndex, raw) 已經有一個卡在 service 裡時，不再多丟一個，直接退回。
+    // 完全沒有可退的資料時照原本同步等。
+    // kGetCapsStale 只在 wrapper 內部用；對外的 getCaps 照樣回 0（ABI caller 把非 0 當失敗），
+    // 是不是退回的結果看 libcacao_client_wrapper_caps_last_stale() / timeout 計數
+    static constexpr int kGetCapsStale = 1;
+
+    static std::atomic<uint64_t> sCapsTimeouts{0};
+
+    // 這條 thread 最近一次 getCaps 是不是用 last-known-good
+    static thread_local bool tLastCapsStale = false;
+
+    static long caps_deadline_ms()
+    {
+        static const long ms = android::wrap_prop_long("persist.vendor.sony.camera.wrap_caps_deadline_ms", 1000);
+        return ms;
+    }
+
+    static android::WrapWorkerPool &caps_deadline_pool()
+    {
+        static android::WrapWorkerPool *pool = new android::WrapWorkerPool("cacao-deadline", 2, 0);
+        return *pool;
+    }
+
+    class CapsInFlight
+    {
+    public:
+        static bool begin(int32_t index, uint64_t raw)
+        {
+            std::lock_guard<std::mutex> _l(lock());
+            for (const auto &k : keys())
+            {
+                if (k.first == index && k.second == raw)
+                    return false;
+            }
+            keys().emplace_back(index, raw);
+            return true;
+        }
+
+        static void end(int32_t index, uint64_t raw)
+        {
+            std::lock_guard<std::mutex> _l(lock());
+            auto &v = keys();
+            for (size_t i = 0; i < v.size(); i++)
+            {
+                if (v[i].first == index && v[i].second == raw)
+                {
+                    v.erase(v.begin() + (long)i);
+                    return;
+                }
+            }
+        }
+
+    private:
+        static std::mutex &lock()
+        {
+            static std::mutex *m = new std::mutex();
+            return *m;
+        }
+
+        static std::vector<std::pair<int32_t, uint64_t>> &keys()
+        {
+            static auto *v = new std::vector<std::pair<int32_t, uint64_t>>();
+            return *v;
+        }
+    };
+
+    struct DeadlineCall
+    {
+        std::mutex lock;
+        std::condition_variable cond;
+        bool done = false;
+        int result = 0;
+
+        void complete(int r)
+        {
+            {
+                std::lock_guard<std::mutex> _l(lock);
+                result = r;
+                done = true;
+            }
+            cond.notify_all();
+        }
+
+        bool waitFor(long ms, int *out)
+        {
+            std::unique_lock<std::mutex> _l(lock);
+            if (!cond.wait_for(_l, std::chrono::milliseconds(ms), [this] { return done; }))
+                return false;
+            *out = result;
+            return true;
+        }
+    };
+
+    static bool has_last_good(int32_t key, uint64_t raw)
+    {
+        if (CapsCache::enabled() && CapsCache::get().hasLastGood(key, raw))
+            return true;
+        return CapsSnapshotStore::enabled() && CapsSnapshotStore::get().contains(key, raw);
+    }
+
+    static bool load_last_good(int32_t key, uint64_t raw, CapsCache::Result *out)
+    {
+        if (CapsCache::enabled() && CapsCache::get().lookupLastGood(key, raw, out))
+            return true;
+        return CapsSnapshotStore::enabled() && CapsSnapshotStore::get().lookup(key, raw, out);
+    }
+
+    // 超時（回 kGetCapsStale）時 worker 還拿著 mem 在寫：caller 不能再用它，也不能還給 exchange
+    static int fetch_caps_with_deadline(android::ICacaoService *svc, const cacao::ProcessCtrlCaps::CameraIndex &idx,
+                                        uint64_t raw, const uint8_t *prepared, uint8_t *reply,
+                                        const android::sp<android::IMemory> &mem)
+    {
+        const long deadlineMs = caps_deadline_ms();
+        const int32_t key = camera_index_key(idx);
+        if (deadlineMs <= 0 || !has_last_good(key, raw))
+            return fetch_caps_from_service(svc, idx, raw, prepared, reply, mem);
+
+        if (!CapsInFlight::begin(key, raw))
+        {
+            sCapsTimeouts.fetch_add(1, std::memory_order_relaxed);
+            return kGetCapsStale;
+        }
+
+        // worker 可能比 caller 活得久：prepared / CameraIndex 都複製進 job，reply 用 job 自己的，mem 由 job 持有
+        // （caller 超時後會放掉 exchange 的 lock）
+        auto call = std::make_shared<DeadlineCall>();
+        std::vector<uint8_t> prep(prepared, prepared + kCapsBlobSize);
+        const bool posted = caps_deadline_pool().post(
+            [call, svc, key, raw, prep, mem]()
+            {
+                CameraIndexStorage copy(key);
+                alignas(8) uint8_t jobReply[kCapsBlobSize];
+                int r = fetch_caps_from_service(svc, copy.ref(), raw, prep.data(), jobReply, mem);
+                CapsInFlight::end(key, raw);
+                call->complete(r);
+            });
+        if (!posted)
+        {
+            CapsInFlight::end(key, raw);
+            return fetch_caps_from_service(svc, idx, raw, prepared, reply, mem);
+        }
+
+        int r = 0;
+        if (call->waitFor(deadlineMs, &r))
+            return r;
+        sCapsTimeouts.fetch_add(1, std::memory_order_relaxed);
+        return kGetCapsStale;
+    }
+
+    // ---------- cold start snapshot 的背景驗證 ----------
+    // snapshot 命中後 caller 不等 service；這裡在背景連上 service，用同一份 request（prepared + mem 內容）拿 live 結果，
+    // fetch_caps_from_service 會寫進 CapsCache，並交給 CapsSnapshotStore::update 比對（不同才重寫檔案）。
+    // 每個 (CameraIndex, raw) 在這個 process 只驗一次
+    static android::WrapWorkerPool &snapshot_verify_pool()
+    {
+        static android::WrapWorkerPool *pool = new android::WrapWorkerPool("cacao-snapcheck", 1, 10);
+        return *pool;
+    }
+
+    static void verify_snapshot_in_background(int32_t key, uint64_t raw, const uint8_t *prepared,
+                                              const android::sp<android::IMemory> &mem)
+    {
+        static std::mutex lock;
+        static auto *verified = new std::vector<std::pair<int32_t, uint64_t>>();
+        {
+            std::lock_guard<std::mutex> _l(lock);
+            for (const auto &k : *verified)
+            {
+                if (k.first == key && k.second == raw)
+                    return;
+            }
+            verified->emplace_back(key, raw);
+        }
+
+        // caller 的 mem 馬上會被 finalize / 下一次 getCaps 用：request 複製一份，job 自己 alloc、blob 改指過去
+        std::vector<uint8_t> prep(prepared, prepared + kCapsBlobSize);
+        const uint8_t *mp = static_cast<const uint8_t *>(mem->unsecurePointer());
+        std::vector<uint8_t> request(mp, mp ? mp + mem->size() : mp);
+        const bool posted = snapshot_verify_pool().post(
+            [key, raw, prep, request]() mutable
+            {
+                android::ICacaoService *svc = ServiceHandle::get().acquire();
+                if (!svc)
+                    return;
+                android::sp<android::IMemory> own = android::allocMemory_common<CapsAllocPolicy>(raw);
+                void *op = own != nullptr ? own->unsecurePointer() : nullptr;
+                if (!op || own->size() != request.size())
+                    return;
+                memcpy(op, request.data(), request.size());
+                caps_blob_attach(prep.data(), own);
+                CameraIndexStorage idx(key);
+                alignas(8) uint8_t reply[kCapsBlobSize];
+                int r = fetch_caps_from_service(svc, idx.ref(), raw, prep.data(), reply, own);
+                if (r != 0)
+                    ALOGE("WRAP: caps snapshot verify failed index=%d raw=0x%llx r=%d", key,
+                          (unsigned long long)raw, r);
+            });
+        if (!posted)
+        {
+            // queue 滿：下次命中再試
+            std::lock_guard<std::mutex> _l(lock);
+            for (size_t i = 0; i < verified->size(); i++)
+            {
+                if ((*verified)[i].first == key && (*verified)[i].second == raw)
+                {
+                    verified->erase(verified->begin() + (long)i);
+                    break;
+                }
+            }
+        }
+    }
+
+    // caps vtable 跟 service 呼叫算 real，其餘是 wrapper overhead
+    static int getCaps_impl(const cacao::ProcessCtrlCaps::CameraIndex &idx, cacao::Caps *caps, uint64_t *raw_out)
+    {
+        static android::LatencyStats::Probe *const latencyProbe = android::LatencyStats::get().probe("getCaps");
+        android::LatencyScope latency(latencyProbe);
+
+        // cold start（還沒連上過 service）先 prepare 再查 snapshot，命中就不等 service；
+        // 否則照原本順序先確認 service
+        const bool cold = !sServiceSeen.load(std::memory_order_acquire) && CapsSnapshotStore::enabled();
+
+        // mService == nullptr 或 mServicePid 不是自己時，原邏輯回 0
+        android::ICacaoService *svc = nullptr;
+        if (!cold)
+        {
+            svc = ServiceHandle::get().acquire();
+            if (!svc)
+                return 0;
+        }
+        // caps 是 nullptr 或 vtable layout 不對：都當成參數錯誤
+        const CapsAbi::Fns *cv = VtableDispatch<CapsAbi>::resolve(caps);
+        if (!cv)
+            return (cold && !ServiceHandle::get().acquire()) ? 0 : -0x67;
 
         // 取 raw size（caps vtable +0x20）
-        uint64_t raw = reinterpret_cast<CapsSizeFn>(Vtbl(caps)[4])(caps);
+        uint64_t raw = caps_raw_size(android::latency_real([&] { return cv->size(caps); }));
+        *raw_out = raw;
+
+        // 原本的 buf_1f0 / buf_388 改用這個 camera 的 exchange（見上面 CapsExchange）
+        const int32_t key = camera_index_key(idx);
+        CapsExchange &ex = caps_exchange(key);
+        std::lock_guard<std::mutex> _l(ex.lock);
 
-        // 用你的 allocator 修正 raw（避免 &0xffffffff / sign-extend）
-        android::sp<android::IMemory> mem =
-            android::allocMemory_common<uint64_t>(raw, "Cacao::getCaps");
-        if (mem == nullptr)
+        // 照原本 prepare 之前就 alloc；size / 指標填進 blob，prepare 跟 finalize 經過它讀寫 payload
+        CapsMemLease lease(ex, raw);
+        if (lease.mem == nullptr)
         {
             ALOGE("WRAP: getCaps alloc failed raw=%" PRIu64, raw);
             return -0x6f;
         }
-
-        // 兩塊 buffer（你反編譯顯示 memcpy 0x198）
-        alignas(8) uint8_t buf_1f0[0x198];
-        alignas(8) uint8_t buf_388[0x198];
-        memset(buf_1f0, 0, sizeof(buf_1f0));
+        memset(ex.prepared, 0, sizeof(ex.prepared));
+        caps_blob_attach(ex.prepared, lease.mem);
 
         // caps vtable +0x28：prepare
-        int rprep = reinterpret_cast<CapsPrepFn>(Vtbl(caps)[5])(caps, buf_1f0);
+        int rprep = android::latency_real([&] { return cv->prepare(caps, ex.prepared); });
         if (rprep < 0)
             return rprep;
 
-        // 呼叫 service vtable +0x30
-        memcpy(buf_388, buf_1f0, sizeof(buf_388));
-        android::ICacaoService *svc = mService.get();
-        int rsvc = reinterpret_cast<SvcGetCapsFn>(Vtbl(svc)[6])(svc, idx, &mem, buf_388);
-        if (rsvc == -0x6e)
-            return -0x6e;
+        // snapshot 命中：檔案裡的 reply / payload 寫回 exchange 再 finalize，live 結果在背景比對
+        // （背景驗證要的是 request，先複製走再蓋 mem）
+        if (cold)
+        {
+            CapsCache::Result snap;
+            if (CapsSnapshotStore::get().lookup(key, raw, &snap) && snap.payload.size() == lease.mem->size())
+            {
+                verify_snapshot_in_background(key, raw, ex.prepared, lease.mem);
+                if (replay_caps(ex.reply, lease.mem, snap.reply, snap.payload))
+                {
+                    caps_blob_attach(ex.reply, lease.mem);
+                    return finalize_caps(cv, caps, ex.prepared);
+                }
+            }
+            svc = ServiceHandle::get().acquire();
+            if (!svc)
+                return 0;
+        }
+
+        // 快取命中：不走 binder，當時 service 回的 reply / payload 寫回 exchange 再 finalize
+        CapsCache::Result cached;
+        if (CapsCache::enabled() && CapsCache::get().lookup(key, raw, svc, ex.prepared, &cached) &&
+            replay_caps(ex.reply, lease.mem, cached.reply, cached.payload))
+            return finalize_caps(cv, caps, ex.prepared);
+
+        // service 端發佈的區塊命中：一樣不走 binder。seqlock 讀失敗時內容不完整，先讀進暫存再蓋 mem；
+        // service 改的是值傳的複本，reply 就是送出去的那份
+        const android::CapsRegion *region = caps_region_reader();
+        if (region && lease.mem->size() <= android::CapsRegion::kMaxPayload)
+        {
+            std::vector<uint8_t> published(lease.mem->size());
+            if (region->read(key, published.data(), published.size()) &&
+                replay_caps(ex.reply, lease.mem, ex.prepared, published))
+                return finalize_caps(cv, caps, ex.prepared);
+        }
+
+        // service 端（binder + cacao service）算 real；等 deadline 的時間也在裡面
+        int rsvc = android::latency_real(
+            [&] { return fetch_caps_with_deadline(svc, idx, raw, ex.prepared, ex.reply, lease.mem); });
+        if (rsvc == kGetCapsStale)
+        {
+            // worker 還拿著原本的 mem（可能正在寫），不還給 exchange、也不讓 finalize 讀它：
+            // last-known-good 寫進新的 mem，blob 改指過去；新的這塊之後還給 exchange
+            lease.mem.clear();
+            CapsCache::Result lkg;
+            if (!load_last_good(key, raw, &lkg))
+                return -0x6f;
+            android::sp<android::IMemory> fresh = android::allocMemory_common<CapsAllocPolicy>(raw);
+            if (fresh == nullptr || !replay_caps(ex.reply, fresh, lkg.reply, lkg.payload))
+                return -0x6f;
+            caps_blob_attach(ex.prepared, fresh);
+            caps_blob_attach(ex.reply, fresh);
+            lease.mem = fresh;
+            int rfin = finalize_caps(cv, caps, ex.prepared);
+            tLastCapsStale = rfin >= 0;
+            return rfin;
+        }
         if (rsvc != 0)
-            return -0x6f;
+            return rsvc;
+
+        return finalize_caps(cv, caps, ex.prepared);
+    }
+
+    __attribute__((visibility("default"))) int getCaps(const cacao::ProcessCtrlCaps::CameraIndex &idx,
+                                                       cacao::Caps *caps)
+    {
+        uint64_t raw = 0;
+        tLastCapsStale = false;
+        int r = getCaps_impl(idx, caps, &raw);
+        // fixed 欄位：1 = 用 last-known-good
+        android::wrap_trace(wraptrace::kEvGetCaps, 0, __builtin_return_address(0), raw, tLastCapsStale ? 1 : 0, r);
+        return r;
+    }
+
+    // ---------- 背景 prefetch ----------
+    // library 載入（CameraApp process）或 libimageprocessorjni 的 JNI_OnLoad 時，
+    // 用低優先權 thread 先連上 service、把 snapshot 讀進來，
+    // 再替 snapshot 記過的每個 (CameraIndex, raw) 先 alloc 好 exchange 的 shared memory。
+    // snapshot 裡沒有 request（prepare 要 caps 物件），不能替 caller 先呼叫 service；
+    // 第一次 getCaps 還是用自己 prepare 出來的 blob 走 service，只是不用等連線跟 alloc。
+    // persist.vendor.sony.camera.wrap_caps_prefetch=0 可關掉
+    static void prefetch_all_caps()
+    {
+        android::ICacaoService *svc = ServiceHandle::get().acquire();
+        if (!svc || !CapsSnapshotStore::enabled())
+            return;
+
+        for (const CapsSnapshotStore::Known &k : CapsSnapshotStore::get().known())
+        {
+            CapsExchange &ex = caps_exchange(k.index);
+            android::sp<android::IMemory> mem = ex.takeMem(k.raw);
+            if (mem == nullptr)
+                mem = android::allocMemory_common<CapsAllocPolicy>(k.raw);
+            if (mem != nullptr)
+                ex.giveMem(k.raw, mem);
+        }
+    }
 
-        // caps vtable +0x30：finalize/commit
-        return reinterpret_cast<CapsFinalFn>(Vtbl(caps)[6])(caps, buf_1f0);
+    static void start_caps_prefetch_once()
+    {
+        static std::atomic<bool> started{false};
+        if (android::wrap_prop_long("persist.vendor.sony.camera.wrap_caps_prefetch", 1) == 0)
+            return;
+        if (started.exchange(true))
+            return;
+        static android::WrapWorkerPool *pool = new android::WrapWorkerPool("cacao-prefetch", 1, 10);
+        if (!pool->post(prefetch_all_caps))
+            started.store(false);
     }
 
 } // namespace android::Cacao
 
+// getCaps 超過 deadline、退回 last-known-good 的次數
+extern "C" __attribute__((visibility("default")))
+uint64_t libcacao_client_wrapper_caps_timeouts()
+{
+    return android::Cacao::sCapsTimeouts.load(std::memory_order_relaxed);
+}
+
+// 呼叫端 thread 最近一次 getCaps 是不是退回 last-known-good：1 是，0 不是
+extern "C" __attribute__((visibility("default")))
+int libcacao_client_wrapper_caps_last_stale()
+{
+    return android::Cacao::tLastCapsStale ? 1 : 0;
+}
+
+// libimageprocessorjni 的 JNI_OnLoad 用 dlsym 呼叫；重複呼叫沒關係
+extern "C" __attribute__((visibility("default")))
+void libcacao_client_wrapper_prefetch_caps()
+{
+    android::Cacao::start_caps_prefetch_once();
+}
+
+// nativeChangeToSuperSlowMode 時由 libimageprocessorjni 的 wrapper 呼叫（見上面 BurstReservation）；
+// 建 / 放 heap 在背景做，不卡 mode 切換；queue 滿回 -EBUSY
+extern "C" __attribute__((visibility("default")))
+int libcacao_client_wrapper_reserve_burst(uint32_t frameBytes, uint32_t frames)
+{
+    if (android::wrap_prop_long("persist.vendor.sony.camera.wrap_burst_reserve", 1) == 0)
+        return 0;
+    return BurstReservation::get().request(frameBytes, frames);
+}
+
+// 只在 CameraApp process 自動開始（zygote / 其他 process 載入時不要開 thread）
+__attribute__((constructor)) static void libcacao_client_wrapper_on_load()
+{
+    char cmdline[128] = {0};
+    int fd = open("/proc/self/cmdline", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    ssize_t n = read(fd, cmdline, sizeof(cmdline) - 1);
+    close(fd);
+    if (n <= 0 || strcmp(cmdline, android::kCameraPkg) != 0)
+        return;
+    android::Cacao::start_caps_prefetch_once();
+}
+
 extern "C" long
 _ZNK7android6Parcel10readIntPtrEv(const android::Parcel *thiz)
 {
@@ -13,81 +13,207 @@
 #include <log/log.h>
 #include <utils/StrongPointer.h>
 
+#include "alloc_stats.h"
+#include "heap_arena.h"
+#include "heap_pool.h"
+#include "latency_hist.h"
+#include "memfd_heap.h"
+#include "prefault.h"
+#include "wrap_trace.h"
+#include "wrap_util.h"
+
 namespace android {
 
-// 判斷是不是 0xffffffffXXXXXXXX 這種 sign-extend 污染
-static inline unsigned long fix_size_ul(unsigned long raw, int* hi_ff_out) {
+// 判斷是不是 0xffffffffXXXXXXXX 這種 sign-extend 污染（一律用 64 bit 看，ILP32 上也不先截掉高位）
+static inline uint64_t fix_size_u64(uint64_t raw, int* hi_ff_out) {
     int hi_ff = 0;
     if ((raw & 0xffffffff00000000ULL) == 0xffffffff00000000ULL) {
         hi_ff = 1;
-        raw = (unsigned long)(uint32_t)raw;
+        raw = (uint32_t)raw;
     }
     if (hi_ff_out) *hi_ff_out = hi_ff;
     return raw;
 }
 
-// ra: 允許 caller 傳 __builtin_return_address(0)，沒傳就顯示 0
-template <typename U>
-static inline sp<IMemory> allocMemory_common(U raw_size, const char* who, void* ra = nullptr) {
-    const unsigned long kCapsMin = 0x198;                 // 408
-    const unsigned long kMax     = 64UL * 1024UL * 1024UL;
-
-    const int pid = (int)getpid();
-#if defined(__BIONIC__)
-    const int tid = (int)gettid();
-#else
-    const int tid = pid;
-#endif
+// allocScatter_common 的 flags
+enum : unsigned {
+    // 用 memfd 後端（size 封住、>= 2 MiB 標 hugepage，見 memfd_heap.h）
+    kAllocMemfd = 1u << 0,
+};
 
-    int hi_ff = 0;
-    unsigned long raw_ul = (unsigned long)raw_size;
-    unsigned long req = fix_size_ul(raw_ul, &hi_ff);
-    unsigned long size = req;
+// persist.vendor.sony.camera.wrap_alloc_memfd=1 時，kMemfdSwitch 的 call site 改走 memfd
+static inline unsigned alloc_backend_flags() {
+    static const unsigned f = wrap_prop_bool("persist.vendor.sony.camera.wrap_alloc_memfd") ? kAllocMemfd : 0u;
+    return f;
+}
 
-    const int caps_path = (who && strcmp(who, "Cacao::getCaps") == 0) ? 1 : 0;
-    int clamp_min = 0;
+// allocMemory_common 的 policy：每個 call site 繼承這個、只改自己要的欄位。
+// 全部 constexpr，用 if constexpr 判斷，該 site 用不到的分支（clamp / 清 0 / arena / pool ...）
+// 在 compile time 就拿掉，不再每次 strcmp who。
+struct AllocPolicyDefaults {
+    static constexpr const char* kWho = "allocMemory";  // AllocStats tag
+    static constexpr unsigned long kClampMin = 0;       // > 0：比這小的 size 拉上來
+    static constexpr uint16_t kTraceFlags = 0;          // 每筆 trace 額外帶的 flag（例如 kFlagCapsPath）
+    static constexpr bool kTrace = true;                // 記成功的 kEvAlloc（reject / 失敗一律記）
+    static constexpr bool kZero = true;                 // false：caller 保證自己寫滿（例如交給 service 填）
+    static constexpr bool kArena = false;               // <= HeapArena::kMaxAlloc 從 arena 切（HeapArena::enabled() 時，heap_arena.h）
+    static constexpr bool kPool = true;                 // false：每次新建 heap，不經 HeapPool
+    static constexpr bool kMemfdSwitch = false;         // 依 alloc_backend_flags() 決定要不要走 memfd
+    static constexpr bool kPrefault = true;             // 新的大 heap 先 fault-in（prefault.h）
+    static constexpr bool kQuota = false;               // 依 owner 做 ClientQuota admission（client_quota.h）
+};
+
+// kPool=false 時用：不回收，只帶 AllocTicket
+class TrackedMemory : public MemoryBase {
+public:
+    TrackedMemory(const sp<MemoryHeapBase>& heap, size_t size) : MemoryBase(heap, 0, size) {}
+
+    AllocTicket ticket;
+};
 
-    if (caps_path && size < kCapsMin) {
-        size = kCapsMin;
-        clamp_min = 1;
+// ra: 允許 caller 傳 __builtin_return_address(0)，沒傳就顯示 0
+// owner: Policy::kArena 時 owner 相同的 allocation 才會落在同一個 heap；Policy::kQuota 時是記帳的對象
+// sign-extend 修正只在 U 比 32 bit 寬時才編進來（ILP32 一律先截成 32 bit，見下面）
+// 清 0 策略：新 heap 是 kernel 給的全 0 mapping，不 memset；
+//           pool 重用的 heap 只清上一輪 dirty high-water 跟這次 window 重疊的部分
+template <typename Policy, typename U>
+static inline sp<IMemory> allocMemory_common(U raw_size, void* ra = nullptr, int owner = 0) {
+    static LatencyStats::Probe* const latencyProbe = LatencyStats::get().probe(Policy::kWho);
+    LatencyScope latency(latencyProbe);
+
+    const unsigned long kMax = 64UL * 1024UL * 1024UL;
+
+#if defined(__LP64__)
+    const uint64_t raw = (uint64_t)raw_size;
+#else
+    // ILP32：原本 cast 成 unsigned long（32 bit）就把高半部丟掉了；arm32 上那半是 r1 的殘值，
+    // 留著會讓 size > kMax 誤判、也會污染 raw（trace / caps 快取 key），所以照原行為明確截成 32 bit
+    const uint64_t raw = (uint32_t)raw_size;
+#endif
+    uint64_t size = raw;
+    uint16_t tflags = Policy::kTraceFlags;
+
+    if constexpr (sizeof(U) > sizeof(uint32_t)) {
+        if ((size & 0xffffffff00000000ULL) == 0xffffffff00000000ULL) {
+            size = (uint32_t)size;
+            tflags |= wraptrace::kFlagHiFF;
+        }
+    }
+    if constexpr (Policy::kClampMin > 0) {
+        if (size < Policy::kClampMin) {
+            size = Policy::kClampMin;
+            tflags |= wraptrace::kFlagClampMin;
+        }
     }
-
-    int reject_max = 0;
-    int reject_e000 = 0;
-    if (size > kMax) reject_max = 1;
-    if (size >= 0xE0000000UL) reject_e000 = 1;
-
-    ALOGE("WRAP: %s allocMemory_common pid=%d tid=%d ra=%p raw=%lu(0x%lx) hi_ff=%d "
-          "fixed=%lu(0x%lx) caps_path=%d clamp_min=%d kCapsMin=%lu kMax=%lu "
-          "reject_max=%d reject_e000=%d req=%lu alloc=%lu",
-          (who ? who : "(null)"),
-          pid, tid, ra,
-          raw_ul, raw_ul, hi_ff,
-          req, req,
-          caps_path, clamp_min, kCapsMin, kMax,
-          reject_max, reject_e000,
-          req, size);
 
     sp<IMemory> mem;
     if (size == 0) return mem;
 
-    if (reject_max || reject_e000) {
-        ALOGE("WRAP: %s allocMemory_common REJECT pid=%d tid=%d ra=%p size=%lu raw=%lu",
-              (who ? who : "(null)"), pid, tid, ra, size, raw_ul);
+    // 超過 kMax 的大 buffer 只能拆開：client 端改用 android::Cacao::allocScatter（scatter_alloc.h）
+    if (size > kMax || size >= 0xE0000000ULL) {
+        wrap_trace(wraptrace::kEvAllocReject, tflags, ra, raw, size, -1);
         return mem;
     }
+    const size_t n = (size_t)size;
+
+    // 額度不夠時在這裡等 / 拒絕；之後每個失敗路徑都要還
+    size_t quota = 0;
+    if constexpr (Policy::kQuota) {
+        if (ClientQuota::get().enabled()) {
+            if (!ClientQuota::get().admit(owner, n)) {
+                wrap_trace(wraptrace::kEvAllocReject, tflags | wraptrace::kFlagQuota, ra, raw, size, -1);
+                return mem;
+            }
+            quota = n;
+        }
+    }
 
-    sp<IMemoryHeap> heap(new (std::nothrow) MemoryHeapBase((size_t)size, 0, nullptr));
-    if (heap == nullptr) return sp<IMemory>();
+    HeapBackend backend = kHeapAshmem;
+    if constexpr (Policy::kMemfdSwitch) {
+        if (alloc_backend_flags() & kAllocMemfd) backend = kHeapMemfd;
+    }
+
+    if constexpr (Policy::kArena) {
+        if (backend == kHeapAshmem && n <= HeapArena::kMaxAlloc && HeapArena::enabled()) {
+            HeapArena::Block b = HeapArena::get().allocate(owner, n);
+            if (b.chunk != nullptr) {
+                ArenaMemory* am = new (std::nothrow) ArenaMemory(owner, b, n);
+                mem = sp<IMemory>(am);
+                if (mem != nullptr) {
+                    am->ticket.arm(Policy::kWho, b.size);
+                    if (quota) am->ticket.holdQuota(owner, quota);
+                    if constexpr (Policy::kZero) {
+                        void* p = mem->unsecurePointer();
+                        if (p && b.dirty) memset(p, 0, b.dirty < n ? b.dirty : n);
+                    }
+                    if (!b.dirty) tflags |= wraptrace::kFlagFresh;
+                    if constexpr (Policy::kTrace)
+                        wrap_trace(wraptrace::kEvAlloc, tflags | wraptrace::kFlagArena, ra, raw, size, 0);
+                    return mem;
+                }
+                // new 失敗時 Block 的 sp 會放掉 chunk，但區塊本身要還回去
+                HeapArena::get().release(owner, b.chunk, b.offset, b.size);
+            }
+            // arena 滿了就退回一般路徑
+        }
+    }
 
-    mem = sp<IMemory>(new (std::nothrow) MemoryBase(heap, 0, (size_t)size));
-    if (mem == nullptr) return sp<IMemory>();
+    HeapPool::Lease lease;
+    if constexpr (Policy::kPool) {
+        // 走 HeapPool：同 size class 的舊 heap 直接重用，省掉 ashmem fd + mmap
+        lease = HeapPool::get().acquire(n, backend);
+    } else {
+        lease.heap = (backend == kHeapMemfd) ? make_memfd_heap(n, "wrap-memfd")
+                                             : sp<MemoryHeapBase>(new (std::nothrow) MemoryHeapBase(n, 0, nullptr));
+        if (lease.heap != nullptr && (lease.heap->getHeapID() < 0 || lease.heap->getBase() == MAP_FAILED))
+            lease.heap.clear();
+        lease.fresh = 1;
+    }
+    if (lease.heap == nullptr) {
+        if (quota) ClientQuota::get().release(owner, quota);
+        wrap_trace(wraptrace::kEvAlloc, tflags, ra, raw, size, -1);
+        return mem;
+    }
+    if (lease.fresh) tflags |= wraptrace::kFlagFresh;
+
+    if constexpr (Policy::kPool) {
+        // pool 放不下的大 heap 也用 PooledMemory：recycle 時會自己略過，這樣每個 allocation 都帶 AllocTicket
+        PooledMemory* pm = new (std::nothrow) PooledMemory(lease.heap, n, lease.dirty, backend);
+        mem = sp<IMemory>(pm);
+        if (pm) {
+            pm->ticket.arm(Policy::kWho, lease.heap->getSize());
+            if (quota) pm->ticket.holdQuota(owner, quota);
+        }
+    } else {
+        TrackedMemory* tm = new (std::nothrow) TrackedMemory(lease.heap, n);
+        mem = sp<IMemory>(tm);
+        if (tm) {
+            tm->ticket.arm(Policy::kWho, lease.heap->getSize());
+            if (quota) tm->ticket.holdQuota(owner, quota);
+        }
+    }
+    if (mem == nullptr) {
+        if (quota) ClientQuota::get().release(owner, quota);
+        wrap_trace(wraptrace::kEvAlloc, tflags, ra, raw, size, -1);
+        return mem;
+    }
 
     void* p = mem->unsecurePointer();
-    if (p) memset(p, 0, (size_t)size);
+    if constexpr (Policy::kZero) {
+        if (p && !lease.fresh && lease.dirty) memset(p, 0, lease.dirty < n ? lease.dirty : n);
+    }
+
+    // 新 heap 而且夠大：先 fault-in（pool 重用的 heap 本來就 map 好了）
+    if constexpr (Policy::kPrefault) {
+        const size_t prefaultMin = prefault_min_bytes();
+        if (p && lease.fresh && prefaultMin && n >= prefaultMin) {
+            int64_t ns = 0;
+            const uint64_t faults = wrap_prefault(lease.heap->getBase(), lease.heap->getSize(), &ns);
+            wrap_trace(wraptrace::kEvPrefault, tflags, ra, lease.heap->getSize(), faults, ns);
+        }
+    }
 
-    ALOGE("WRAP: %s allocMemory_common OK pid=%d tid=%d ra=%p sz=%lu ptr=%p",
-          (who ? who : "(null)"), pid, tid, ra, size, p);
+    if constexpr (Policy::kTrace) wrap_trace(wraptrace::kEvAlloc, tflags, ra, raw, size, 0);
 
     return mem;
 }
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "client_quota.h"
+#include "wrap_util.h"
+
+namespace android {
+
+// allocMemory_common 依 who tag 分開統計的 live 計數（找出低 RAM 機器上是哪條路徑撐大 shared-memory RSS）
+// - 每個 tag：live bytes / live count / peak bytes / 累計 count、bytes / lifetime histogram
+// - 全部 relaxed atomic；tag 表固定 kMaxTags 格，滿了算進最後一格 "(other)"
+// - tag 通常是字串常數：先比指標，不同 TU 的同字串再 strcmp 一次
+// - 每個 allocation 帶一個 AllocTicket（放在回傳的 MemoryBase 子類裡），dtor 時扣回去並記 lifetime
+class AllocStats {
+public:
+    static constexpr size_t kMaxTags = 16;
+    // lifetime bucket 上限（ms）：<1, <4, <16, <64, <256, <1024, <4096, <16384, <65536, 其他
+    static constexpr unsigned kBuckets = 10;
+
+    struct Tag {
+        std::atomic<const char*> who{nullptr};
+        std::atomic<uint64_t> liveBytes{0};
+        std::atomic<uint64_t> liveCount{0};
+        std::atomic<uint64_t> peakBytes{0};
+        std::atomic<uint64_t> totalCount{0};
+        std::atomic<uint64_t> totalBytes{0};
+        std::atomic<uint64_t> lifetime[kBuckets];
+
+        Tag() {
+            for (unsigned i = 0; i < kBuckets; i++) lifetime[i].store(0, std::memory_order_relaxed);
+        }
+    };
+
+    static AllocStats& get() {
+        static AllocStats* s = new AllocStats();
+        return *s;
+    }
+
+    Tag* tag(const char* who) {
+        if (!who) who = "(null)";
+        for (size_t i = 0; i < kMaxTags - 1; i++) {
+            const char* cur = mTags[i].who.load(std::memory_order_acquire);
+            if (cur == who) return &mTags[i];
+            if (cur == nullptr) {
+                if (mTags[i].who.compare_exchange_strong(cur, who, std::memory_order_acq_rel)) return &mTags[i];
+                // 別人剛搶走這格；cur 已更新成對方的 tag，往下比對
+            }
+            if (cur && strcmp(cur, who) == 0) return &mTags[i];
+        }
+        return &mTags[kMaxTags - 1];
+    }
+
+    static unsigned bucketOf(int64_t ns) {
+        int64_t limitMs = 1;
+        for (unsigned b = 0; b < kBuckets - 1; b++, limitMs *= 4) {
+            if (ns < limitMs * 1000000LL) return b;
+        }
+        return kBuckets - 1;
+    }
+
+    static void onAlloc(Tag* t, uint64_t bytes) {
+        const uint64_t live = t->liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        t->liveCount.fetch_add(1, std::memory_order_relaxed);
+        t->totalCount.fetch_add(1, std::memory_order_relaxed);
+        t->totalBytes.fetch_add(bytes, std::memory_order_relaxed);
+        uint64_t peak = t->peakBytes.load(std::memory_order_relaxed);
+        while (live > peak && !t->peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+        }
+    }
+
+    static void onFree(Tag* t, uint64_t bytes, int64_t lifetimeNs) {
+        t->liveBytes.fetch_sub(bytes, std::memory_order_relaxed);
+        t->liveCount.fetch_sub(1, std::memory_order_relaxed);
+        t->lifetime[bucketOf(lifetimeNs)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 文字格式，一個 tag 一行；回傳寫出的 tag 數，失敗 -1
+    int dump(int fd) {
+        if (fd < 0) return -1;
+        dprintf(fd, "who live_bytes live_count peak_bytes total_count total_bytes lifetime_ms[<1 <4 <16 <64 <256 <1k "
+                    "<4k <16k <64k >=64k]\n");
+        int n = 0;
+        for (size_t i = 0; i < kMaxTags; i++) {
+            Tag& t = mTags[i];
+            const char* who = t.who.load(std::memory_order_acquire);
+            if (!who) continue;
+            dprintf(fd, "%s %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64, who,
+                    t.liveBytes.load(std::memory_order_relaxed), t.liveCount.load(std::memory_order_relaxed),
+                    t.peakBytes.load(std::memory_order_relaxed), t.totalCount.load(std::memory_order_relaxed),
+                    t.totalBytes.load(std::memory_order_relaxed));
+            for (unsigned b = 0; b < kBuckets; b++)
+                dprintf(fd, " %" PRIu64, t.lifetime[b].load(std::memory_order_relaxed));
+            dprintf(fd, "\n");
+            n++;
+        }
+        return n;
+    }
+
+private:
+    AllocStats() { mTags[kMaxTags - 1].who.store("(other)", std::memory_order_relaxed); }
+
+    Tag mTags[kMaxTags];
+};
+
+// 一個 allocation 的帳（AllocStats，必要時加 ClientQuota）；放在 MemoryBase 子類當 member，物件消失時自動扣回
+class AllocTicket {
+public:
+    AllocTicket() = default;
+    AllocTicket(const AllocTicket&) = delete;
+    AllocTicket& operator=(const AllocTicket&) = delete;
+    ~AllocTicket() {
+        if (mTag) AllocStats::onFree(mTag, mBytes, wrap_now_ns() - mStartNs);
+        if (mQuotaBytes) ClientQuota::get().release(mQuotaOwner, mQuotaBytes);
+    }
+
+    // ClientQuota::admit 成功後交給 ticket，dtor 時 release
+    void holdQuota(int owner, size_t bytes) {
+        mQuotaOwner = owner;
+        mQuotaBytes = bytes;
+    }
+
+    void arm(const char* who, uint64_t bytes) {
+        mTag = AllocStats::get().tag(who);
+        mBytes = bytes;
+        mStartNs = wrap_now_ns();
+        AllocStats::onAlloc(mTag, bytes);
+    }
+
+private:
+    AllocStats::Tag* mTag = nullptr;
+    uint64_t mBytes = 0;
+    int64_t mStartNs = 0;
+    int mQuotaOwner = 0;
+    size_t mQuotaBytes = 0;
+};
+
+} // namespace android
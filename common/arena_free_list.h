@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <iterator>
+#include <map>
+
+namespace android {
+
+// HeapArena 一個 chunk 裡的空間管理（不碰 binder / heap，host test 直接用）
+// - first-fit free list（offset -> size），釋放時合併前後相鄰的空塊
+// - highWater：曾借出過的最高位置；以上從沒寫過，保證是 0
+// 不上鎖，由 HeapArena 的 lock 保護
+class ArenaFreeList {
+public:
+    explicit ArenaFreeList(size_t capacity) : mCapacity(capacity) {
+        if (capacity) mFree[0] = capacity;
+    }
+
+    // 成功時 *offset 是切出來的位置，*dirty 是 [offset, offset+dirty) 可能不是 0 的長度
+    bool carve(size_t need, size_t* offset, size_t* dirty) {
+        if (need == 0) return false;
+        for (auto it = mFree.begin(); it != mFree.end(); ++it) {
+            if (it->second < need) continue;
+            const size_t off = it->first;
+            const size_t rest = it->second - need;
+            mFree.erase(it);
+            if (rest) mFree[off + need] = rest;
+            *offset = off;
+            *dirty = mHighWater > off ? (mHighWater - off < need ? mHighWater - off : need) : 0;
+            if (off + need > mHighWater) mHighWater = off + need;
+            return true;
+        }
+        return false;
+    }
+
+    // len 要跟 carve 時的 need 一樣
+    void release(size_t offset, size_t len) {
+        auto next = mFree.lower_bound(offset);
+        size_t start = offset;
+        size_t end = offset + len;
+        if (next != mFree.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == start) {
+                start = prev->first;
+                mFree.erase(prev);
+            }
+        }
+        if (next != mFree.end() && next->first == end) {
+            end += next->second;
+            mFree.erase(next);
+        }
+        mFree[start] = end - start;
+    }
+
+    size_t capacity() const { return mCapacity; }
+    size_t highWater() const { return mHighWater; }
+    const std::map<size_t, size_t>& blocks() const { return mFree; }
+
+    size_t freeBytes() const {
+        size_t n = 0;
+        for (const auto& kv : mFree) n += kv.second;
+        return n;
+    }
+
+private:
+    const size_t mCapacity;
+    std::map<size_t, size_t> mFree; // offset -> size
+    size_t mHighWater = 0;
+};
+
+} // namespace android
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <vector>
+
+#include "wrap_util.h"
+
+namespace android {
+
+// getCaps 結果的 in-process 快取（client wrapper 用；不碰 binder，host test 直接用）
+// camera 開著的期間 caps 不會變，同一個 (CameraIndex, caps raw size) 第二次起不再 binder：
+// 命中時把當時 service 的結果（reply blob + shared memory 內容）寫回 exchange，再照原流程 finalize
+// - key 另外比 prepare 寫出的 blob（同一個 process、同一塊 exchange memory，內容不同就當 miss）
+// - payload 存 copy：exchange 的 IMemory 下一次呼叫會重用、內容會被蓋掉；超過 kMaxPayload 不快取
+// - service 物件換了（死掉重連）或 pid 變了（fork）就整個清掉
+// - 另外留一份 last-known-good（reply + payload，key 只有 (CameraIndex, raw)，清快取、換 service 都不清），
+//   給 getCaps 超過 deadline 時退回用
+// - persist.vendor.sony.camera.wrap_caps_cache=0 可關掉
+class CapsCache {
+public:
+    static constexpr size_t kBlobSize   = 0x198;
+    static constexpr size_t kMaxPayload = 1024 * 1024;
+
+    struct Result {
+        uint8_t reply[kBlobSize];
+        std::vector<uint8_t> payload;
+    };
+
+    static CapsCache& get() {
+        static CapsCache* c = new CapsCache();
+        return *c;
+    }
+
+    static bool enabled() {
+        static const bool on = wrap_prop_long("persist.vendor.sony.camera.wrap_caps_cache", 1) != 0;
+        return on;
+    }
+
+    // 一般用 get()；host test 自己建
+    CapsCache() = default;
+    CapsCache(const CapsCache&) = delete;
+    CapsCache& operator=(const CapsCache&) = delete;
+
+    // 命中時把 reply / payload 複製到 out（lock 外才寫回 exchange）
+    bool lookup(int32_t index, uint64_t raw, const void* svc, const uint8_t* prepared, Result* out) {
+        std::lock_guard<std::mutex> _l(mLock);
+        validateLocked(svc);
+        for (const Entry& e : mEntries) {
+            if (e.index != index || e.raw != raw) continue;
+            if (memcmp(e.prepared, prepared, kBlobSize) != 0) return false;
+            memcpy(out->reply, e.reply, kBlobSize);
+            out->payload = e.payload;
+            return true;
+        }
+        return false;
+    }
+
+    void store(int32_t index, uint64_t raw, const void* svc, const uint8_t* prepared, const uint8_t* reply,
+               const void* payload, size_t payloadSize) {
+        if (payloadSize > kMaxPayload || (payloadSize && !payload)) return;
+        const uint8_t* pp = static_cast<const uint8_t*>(payload);
+
+        std::lock_guard<std::mutex> _l(mLock);
+        validateLocked(svc);
+        Entry* slot = nullptr;
+        for (Entry& e : mEntries) {
+            if (e.index == index && e.raw == raw) {
+                slot = &e;
+                break;
+            }
+        }
+        if (!slot) {
+            mEntries.emplace_back();
+            slot = &mEntries.back();
+            slot->index = index;
+            slot->raw = raw;
+        }
+        memcpy(slot->prepared, prepared, kBlobSize);
+        memcpy(slot->reply, reply, kBlobSize);
+        slot->payload.assign(pp, pp + payloadSize);
+
+        LastGood* lkg = nullptr;
+        for (LastGood& g : mLastGood) {
+            if (g.index == index && g.raw == raw) {
+                lkg = &g;
+                break;
+            }
+        }
+        if (!lkg) {
+            mLastGood.emplace_back();
+            lkg = &mLastGood.back();
+            lkg->index = index;
+            lkg->raw = raw;
+        }
+        memcpy(lkg->reply, reply, kBlobSize);
+        lkg->payload.assign(pp, pp + payloadSize);
+    }
+
+    bool hasLastGood(int32_t index, uint64_t raw) {
+        std::lock_guard<std::mutex> _l(mLock);
+        return findLastGoodLocked(index, raw) != nullptr;
+    }
+
+    bool lookupLastGood(int32_t index, uint64_t raw, Result* out) {
+        std::lock_guard<std::mutex> _l(mLock);
+        const LastGood* g = findLastGoodLocked(index, raw);
+        if (!g) return false;
+        memcpy(out->reply, g->reply, kBlobSize);
+        out->payload = g->payload;
+        return true;
+    }
+
+    void invalidate() {
+        std::lock_guard<std::mutex> _l(mLock);
+        mEntries.clear();
+    }
+
+private:
+    struct Entry {
+        int32_t index;
+        uint64_t raw;
+        uint8_t prepared[kBlobSize];
+        uint8_t reply[kBlobSize];
+        std::vector<uint8_t> payload;
+    };
+
+    struct LastGood {
+        int32_t index;
+        uint64_t raw;
+        uint8_t reply[kBlobSize];
+        std::vector<uint8_t> payload;
+    };
+
+    const LastGood* findLastGoodLocked(int32_t index, uint64_t raw) const {
+        for (const LastGood& g : mLastGood) {
+            if (g.index == index && g.raw == raw) return &g;
+        }
+        return nullptr;
+    }
+
+    void validateLocked(const void* svc) {
+        const int pid = (int)getpid();
+        if (svc == mSvc && pid == mPid) return;
+        mEntries.clear();
+        mSvc = svc;
+        mPid = pid;
+    }
+
+    std::mutex mLock;
+    std::vector<Entry> mEntries;
+    std::vector<LastGood> mLastGood;
+    const void* mSvc = nullptr;
+    int mPid = 0;
+};
+
+} // namespace android
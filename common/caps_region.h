@@ -0,0 +1,215 @@
+#pragma once
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "wrap_util.h"
+
+namespace android {
+
+// service 端發佈、client 端唯讀 map 的跨 process caps 區塊
+// - 檔案 layout 固定：Header + Slot[kSlots]，arm / arm64 相同
+// - service 端（libcacao_service 的 wrapper 攔 CacaoService::getCaps）O_RDWR map 後用 per-slot seqlock 寫，
+//   每次內容有變 generation +1；slot 滿了蓋掉最久沒寫的那格
+// - 存的是 service 填好的 shared memory（payload）；key 是 (CameraIndex, payload 大小)。
+//   service 收到的 SerializedData 帶著 client 自己的 mem 指標，每個 process 都不同，不能當 key；
+//   service 端不知道 client 的 raw size，payload 大小（= client alloc 的 IMemory 大小）兩邊都看得到
+// - client 端 O_RDONLY + PROT_READ map 一次，之後查 caps 只 copy payload、不用 binder
+// - v2 多存一份 blob 當 key，版本不同 writer 會整個重設
+// - fingerprint 不同（OTA）就當作沒有
+// client 沒有不經 binder 拿 fd 的管道，所以用檔案而不是 sealed memfd；
+// 唯讀靠 0640 權限 + client 端只開 O_RDONLY / PROT_READ。
+// 要用的話：client process 要在檔案的 group 裡，而且 SELinux 要另外放行
+// （service domain 建立 / 寫、client domain 讀這個檔案的 type）；這兩件事不在這個 repo 裡，
+// 所以預設關著（persist.vendor.sony.camera.wrap_caps_region=1 才開）。
+class CapsRegion {
+public:
+    static constexpr uint32_t kMagic      = 0x47455243; // "CREG"
+    static constexpr uint32_t kVersion    = 3;
+    static constexpr uint32_t kSlots      = 8;
+    static constexpr uint32_t kMaxPayload = 64 * 1024;
+    static constexpr mode_t   kFileMode   = 0640;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t slot_count;
+        uint32_t slot_size;
+        uint32_t generation; // 每次 publish 有變 +1（atomic 存取）
+        uint32_t reserved;
+        char fingerprint[96];
+    };
+
+    struct Slot {
+        uint32_t seq; // 奇數 = 寫入中；0 = 空
+        int32_t index;
+        uint32_t stamp; // 最後一次寫入時的 generation，挑要蓋掉的 slot 用
+        uint32_t payload_size;
+        uint8_t payload[kMaxPayload];
+    };
+
+    static constexpr size_t kFileSize = sizeof(Header) + kSlots * sizeof(Slot);
+
+    static bool enabled() {
+        static const bool on = wrap_prop_long("persist.vendor.sony.camera.wrap_caps_region", 0) != 0;
+        return on;
+    }
+
+    // 兩邊都要能存取這個路徑（見上面）
+    static const std::string& path() {
+        static const std::string* p = [] {
+            char v[PROP_VALUE_MAX] = {0};
+            if (wrap_prop_get("persist.vendor.sony.camera.wrap_caps_region_path", v) > 0)
+                return new std::string(v);
+            return new std::string("/data/vendor/camera/cacao_caps.region");
+        }();
+        return *p;
+    }
+
+    CapsRegion() = default;
+    CapsRegion(const CapsRegion&) = delete;
+    CapsRegion& operator=(const CapsRegion&) = delete;
+    ~CapsRegion() {
+        if (mBase) munmap(mBase, kFileSize);
+    }
+
+    // service 端：建立 / 重設檔案並 map 成可寫
+    bool openWriter(const std::string& path, const std::string& fingerprint) {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, kFileMode);
+        if (fd < 0) return false;
+        fchmod(fd, kFileMode);
+        if (ftruncate(fd, (off_t)kFileSize) != 0) {
+            ::close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, kFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+        mBase = static_cast<uint8_t*>(p);
+        mWritable = true;
+
+        // 格式或 fingerprint 不同就整個清掉重來
+        Header* h = header();
+        if (h->magic != kMagic || h->version != kVersion || h->slot_size != sizeof(Slot) ||
+            strncmp(h->fingerprint, fingerprint.c_str(), sizeof(h->fingerprint)) != 0) {
+            h->magic = 0;
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            memset(mBase + sizeof(Header), 0, kSlots * sizeof(Slot));
+            h->version = kVersion;
+            h->slot_count = kSlots;
+            h->slot_size = sizeof(Slot);
+            memset(h->fingerprint, 0, sizeof(h->fingerprint));
+            strncpy(h->fingerprint, fingerprint.c_str(), sizeof(h->fingerprint) - 1);
+            __atomic_store_n(&h->generation, 0u, __ATOMIC_RELAXED);
+            __atomic_store_n(&h->magic, kMagic, __ATOMIC_RELEASE);
+        }
+        return true;
+    }
+
+    // client 端：唯讀 map
+    bool openReader(const std::string& path, const std::string& fingerprint) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size != (off_t)kFileSize) {
+            ::close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, kFileSize, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+        mBase = static_cast<uint8_t*>(p);
+
+        const Header* h = header();
+        if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != kMagic || h->version != kVersion ||
+            h->slot_count != kSlots || h->slot_size != sizeof(Slot) ||
+            strncmp(h->fingerprint, fingerprint.c_str(), sizeof(h->fingerprint)) != 0) {
+            munmap(mBase, kFileSize);
+            mBase = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+    bool mapped() const { return mBase != nullptr; }
+
+    uint32_t generation() const {
+        return mBase ? __atomic_load_n(&header()->generation, __ATOMIC_ACQUIRE) : 0;
+    }
+
+    // service 端寫入；內容沒變就不動，payload 太大回 false
+    bool publish(int32_t index, const void* payload, size_t payloadSize) {
+        if (!mBase || !mWritable || payloadSize > kMaxPayload || (payloadSize && !payload)) return false;
+
+        // 同一個 key → 空格 → stamp 最小（最久沒寫）的那格
+        Slot* target = nullptr;
+        Slot* empty = nullptr;
+        Slot* oldest = nullptr;
+        for (uint32_t i = 0; i < kSlots; i++) {
+            Slot* s = slot(i);
+            const uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+            if (seq == 0) {
+                if (!empty) empty = s;
+                continue;
+            }
+            if (s->index == index && s->payload_size == payloadSize) {
+                target = s;
+                break;
+            }
+            if (!oldest || (int32_t)(s->stamp - oldest->stamp) < 0) oldest = s;
+        }
+        if (target && (payloadSize == 0 || memcmp(target->payload, payload, payloadSize) == 0))
+            return true;
+        if (!target) target = empty ? empty : oldest;
+
+        Header* h = header();
+        const uint32_t gen = __atomic_load_n(&h->generation, __ATOMIC_RELAXED) + 1u;
+        const uint32_t seq = __atomic_load_n(&target->seq, __ATOMIC_RELAXED);
+        __atomic_store_n(&target->seq, seq | 1u, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        target->index = index;
+        target->stamp = gen;
+        target->payload_size = (uint32_t)payloadSize;
+        if (payloadSize) memcpy(target->payload, payload, payloadSize);
+        __atomic_store_n(&target->seq, (seq | 1u) + 1u, __ATOMIC_RELEASE);
+        __atomic_store_n(&h->generation, gen, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // client 端：(index, size) 的 payload 複製到 dst；seqlock 讀，讀到一半被改寫就重讀，
+    // 失敗時 dst 內容未定（caller 要給暫存 buffer）
+    bool read(int32_t index, void* dst, size_t size) const {
+        if (!mBase || size > kMaxPayload) return false;
+        for (uint32_t i = 0; i < kSlots; i++) {
+            const Slot* s = slot(i);
+            for (int attempt = 0; attempt < 4; attempt++) {
+                const uint32_t s1 = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+                if (s1 == 0) break;
+                if (s1 & 1u) continue; // 寫入中，重讀
+                const bool hit = s->index == index && s->payload_size == size;
+                if (hit && size) memcpy(dst, s->payload, size);
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != s1) continue;
+                if (hit) return true;
+                break;
+            }
+        }
+        return false;
+    }
+
+private:
+    Header* header() const { return reinterpret_cast<Header*>(mBase); }
+    Slot* slot(uint32_t i) const { return reinterpret_cast<Slot*>(mBase + sizeof(Header)) + i; }
+
+    uint8_t* mBase = nullptr;
+    bool mWritable = false;
+};
+
+} // namespace android
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+namespace android {
+
+// getCaps 結果的 on-disk snapshot，cold start 時 service 還沒起來也能先回 caps
+// 檔案格式（little-endian，arm / arm64 同 layout，可以直接 mmap 讀）：
+//   Header | Entry[count] | payload ...（每段 8 bytes 對齊）
+// fingerprint 跟目前 ro.build.fingerprint 不同就整個不用（OTA 後 caps 可能變了）
+// key 只有 (CameraIndex, raw)：prepare 出來的 blob 帶著 process 自己的 mem 指標，跨 process 比不了；
+// 存的是 service 回的 reply（指標欄位由寫入端清掉）跟 shared memory 內容
+// v1 多存一份 prepared 當 key，讀到 v1 當成沒有 snapshot
+class CapsSnapshot {
+public:
+    static constexpr uint32_t kMagic      = 0x504e5343; // "CSNP"
+    static constexpr uint32_t kVersion    = 2;
+    static constexpr size_t   kBlobSize   = 0x198;
+    static constexpr uint32_t kMaxEntries = 16;
+    static constexpr uint32_t kMaxPayload = 1024 * 1024;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t count;
+        uint32_t entry_size;
+        char fingerprint[96]; // PROP_VALUE_MAX=92，留 NUL
+        uint64_t file_size;
+    };
+
+    struct Entry {
+        int32_t index;
+        uint32_t payload_size;
+        uint64_t raw;
+        uint64_t payload_offset; // 從檔頭算
+        uint8_t reply[kBlobSize];
+    };
+
+    // write() 用；指標只需在呼叫期間有效
+    struct Record {
+        int32_t index;
+        uint64_t raw;
+        const uint8_t* reply;
+        const void* payload;
+        size_t payload_size;
+    };
+
+    CapsSnapshot() = default;
+    CapsSnapshot(const CapsSnapshot&) = delete;
+    CapsSnapshot& operator=(const CapsSnapshot&) = delete;
+    ~CapsSnapshot() { close(); }
+
+    // mmap 唯讀；格式或 fingerprint 不符回 false
+    bool open(const std::string& path, const std::string& fingerprint) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header) ||
+            st.st_size > (off_t)(sizeof(Header) + kMaxEntries * (sizeof(Entry) + kMaxPayload))) {
+            ::close(fd);
+            return false;
+        }
+
+        void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+        mBase = static_cast<const uint8_t*>(p);
+        mSize = (size_t)st.st_size;
+
+        const Header* h = header();
+        const bool ok = h->magic == kMagic && h->version == kVersion && h->entry_size == sizeof(Entry) &&
+                        h->count <= kMaxEntries && h->file_size == mSize &&
+                        sizeof(Header) + (size_t)h->count * sizeof(Entry) <= mSize &&
+                        strncmp(h->fingerprint, fingerprint.c_str(), sizeof(h->fingerprint)) == 0 &&
+                        payloadsInRange();
+        if (!ok) close();
+        return ok;
+    }
+
+    void close() {
+        if (mBase) munmap(const_cast<uint8_t*>(mBase), mSize);
+        mBase = nullptr;
+        mSize = 0;
+    }
+
+    bool loaded() const { return mBase != nullptr; }
+
+    uint32_t count() const { return mBase ? header()->count : 0; }
+
+    const Entry* entryAt(uint32_t i) const {
+        return reinterpret_cast<const Entry*>(mBase + sizeof(Header)) + i;
+    }
+
+    const Entry* find(int32_t index, uint64_t raw) const {
+        for (uint32_t i = 0; i < count(); i++) {
+            const Entry* e = entryAt(i);
+            if (e->index == index && e->raw == raw) return e;
+        }
+        return nullptr;
+    }
+
+    const void* payloadOf(const Entry* e) const { return mBase + e->payload_offset; }
+
+    // 寫到 path.tmp 再 rename，讀的人不會看到寫一半的檔
+    static bool write(const std::string& path, const std::string& fingerprint, const std::vector<Record>& recs) {
+        if (recs.size() > kMaxEntries) return false;
+
+        std::vector<uint8_t> out;
+        size_t off = align8(sizeof(Header) + recs.size() * sizeof(Entry));
+        size_t total = off;
+        for (const Record& r : recs) {
+            if (r.payload_size > kMaxPayload) return false;
+            total = align8(total + r.payload_size);
+        }
+        out.assign(total, 0);
+
+        Header* h = reinterpret_cast<Header*>(out.data());
+        h->magic = kMagic;
+        h->version = kVersion;
+        h->count = (uint32_t)recs.size();
+        h->entry_size = sizeof(Entry);
+        strncpy(h->fingerprint, fingerprint.c_str(), sizeof(h->fingerprint) - 1);
+        h->file_size = total;
+
+        Entry* ents = reinterpret_cast<Entry*>(out.data() + sizeof(Header));
+        for (size_t i = 0; i < recs.size(); i++) {
+            const Record& r = recs[i];
+            Entry& e = ents[i];
+            e.index = r.index;
+            e.raw = r.raw;
+            e.payload_size = (uint32_t)r.payload_size;
+            e.payload_offset = off;
+            memcpy(e.reply, r.reply, kBlobSize);
+            if (r.payload_size) memcpy(out.data() + off, r.payload, r.payload_size);
+            off = align8(off + r.payload_size);
+        }
+
+        const std::string tmp = path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) return false;
+        const uint8_t* p = out.data();
+        size_t left = out.size();
+        while (left > 0) {
+            ssize_t n = ::write(fd, p, left);
+            if (n <= 0) {
+                ::close(fd);
+                unlink(tmp.c_str());
+                return false;
+            }
+            p += (size_t)n;
+            left -= (size_t)n;
+        }
+        fsync(fd);
+        ::close(fd);
+        if (rename(tmp.c_str(), path.c_str()) != 0) {
+            unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static size_t align8(size_t v) { return (v + 7) & ~(size_t)7; }
+
+    const Header* header() const { return reinterpret_cast<const Header*>(mBase); }
+
+    bool payloadsInRange() const {
+        for (uint32_t i = 0; i < header()->count; i++) {
+            const Entry* e = entryAt(i);
+            if (e->payload_size > kMaxPayload || e->payload_offset > mSize ||
+                e->payload_size > mSize - e->payload_offset)
+                return false;
+        }
+        return true;
+    }
+
+    const uint8_t* mBase = nullptr;
+    size_t mSize = 0;
+};
+
+} // namespace android
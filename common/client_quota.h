@@ -0,0 +1,146 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+
+#include "wrap_util.h"
+
+namespace android {
+
+// service 端依 client（calling pid）記 shared-memory 用量，做 admission control
+// - per-client 上限：persist.vendor.sony.camera.wrap_client_quota_mb
+// - 整個 service 上限：persist.vendor.sony.camera.wrap_service_quota_mb
+//   預設都是 0 = 關（合適的上限要看實際 burst 用量再定）
+// - 超過時先等別人釋放（backpressure），最多 persist.vendor.sony.camera.wrap_quota_wait_ms（預設 200），
+//   還是放不下就拒絕；單筆就超過上限的直接拒絕
+// - 放不下時是等 / 拒絕新的那筆，不會去動別的 client 已經拿到的 heap
+// - 用量回到 0 的 client 就從表裡拿掉：pid 死掉時 binder 放掉它持有的 IMemory，帳也跟著歸 0，
+//   表不會隨著來過的 pid 一直長；拒絕次數記在整個 service 的計數
+class ClientQuota {
+public:
+    struct Usage {
+        uint64_t bytes = 0;
+        uint64_t peak = 0;
+        uint64_t admitted = 0;
+        uint64_t waited = 0;
+    };
+
+    static ClientQuota& get() {
+        static ClientQuota* q = new ClientQuota();
+        return *q;
+    }
+
+    bool enabled() const { return mClientLimit || mServiceLimit; }
+
+    // 成功時已記帳，之後要 release(owner, bytes)
+    bool admit(int owner, size_t bytes) {
+        std::unique_lock<std::mutex> _l(mLock);
+        if ((mClientLimit && bytes > mClientLimit) || (mServiceLimit && bytes > mServiceLimit)) {
+            mRejected++;
+            return false;
+        }
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(mWaitMs);
+        bool waited = false;
+        // wait 期間別的 thread 可能把這個 owner 的 entry 拿掉，每次都重新查
+        while (!fitsLocked(clientBytesLocked(owner), bytes)) {
+            waited = true;
+            if (mCond.wait_until(_l, deadline) == std::cv_status::timeout &&
+                !fitsLocked(clientBytesLocked(owner), bytes)) {
+                mRejected++;
+                return false;
+            }
+        }
+        Usage& u = mClients[owner];
+        u.bytes += bytes;
+        if (u.bytes > u.peak) u.peak = u.bytes;
+        u.admitted++;
+        if (waited) u.waited++;
+        mTotal += bytes;
+        return true;
+    }
+
+    void release(int owner, size_t bytes) {
+        {
+            std::lock_guard<std::mutex> _l(mLock);
+            auto it = mClients.find(owner);
+            if (it != mClients.end()) {
+                it->second.bytes = bytes > it->second.bytes ? 0 : it->second.bytes - bytes;
+                if (it->second.bytes == 0) mClients.erase(it);
+            }
+            mTotal = bytes > mTotal ? 0 : mTotal - bytes;
+        }
+        mCond.notify_all();
+    }
+
+    // 目前有記帳的 client 數（host test / dump 用）
+    size_t clients() {
+        std::lock_guard<std::mutex> _l(mLock);
+        return mClients.size();
+    }
+
+    uint64_t bytesOf(int owner) {
+        std::lock_guard<std::mutex> _l(mLock);
+        return clientBytesLocked(owner);
+    }
+
+    // 文字格式，一個 client 一行；回傳寫出的行數，失敗 -1
+    int dump(int fd) {
+        if (fd < 0) return -1;
+        std::lock_guard<std::mutex> _l(mLock);
+        dprintf(fd, "total=%" PRIu64 " client_limit=%zu service_limit=%zu wait_ms=%ld rejected=%" PRIu64 "\n", mTotal,
+                mClientLimit, mServiceLimit, mWaitMs, mRejected);
+        dprintf(fd, "pid bytes peak admitted waited\n");
+        int n = 0;
+        for (const auto& kv : mClients) {
+            const Usage& u = kv.second;
+            dprintf(fd, "%d %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", kv.first, u.bytes, u.peak, u.admitted,
+                    u.waited);
+            n++;
+        }
+        return n;
+    }
+
+private:
+    ClientQuota()
+        : ClientQuota(wrap_prop_long("persist.vendor.sony.camera.wrap_client_quota_mb", 0),
+                      wrap_prop_long("persist.vendor.sony.camera.wrap_service_quota_mb", 0),
+                      wrap_prop_long("persist.vendor.sony.camera.wrap_quota_wait_ms", 200)) {}
+
+public:
+    // 直接給上限（MiB，<= 0 = 關）；一般用 get()，這個給 host test
+    ClientQuota(long clientMb, long serviceMb, long waitMs) {
+        mClientLimit = clientMb > 0 ? (size_t)clientMb << 20 : 0;
+        mServiceLimit = serviceMb > 0 ? (size_t)serviceMb << 20 : 0;
+        mWaitMs = waitMs > 0 ? waitMs : 0;
+    }
+
+private:
+    uint64_t clientBytesLocked(int owner) const {
+        auto it = mClients.find(owner);
+        return it != mClients.end() ? it->second.bytes : 0;
+    }
+
+    bool fitsLocked(uint64_t clientBytes, size_t bytes) const {
+        if (mClientLimit && clientBytes + bytes > mClientLimit) return false;
+        if (mServiceLimit && mTotal + bytes > mServiceLimit) return false;
+        return true;
+    }
+
+    std::mutex mLock;
+    std::condition_variable mCond;
+    std::map<int, Usage> mClients;
+    uint64_t mTotal = 0;
+    uint64_t mRejected = 0;
+    size_t mClientLimit = 0;
+    size_t mServiceLimit = 0;
+    long mWaitMs = 0;
+};
+
+} // namespace android
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+
+#include <log/log.h>
+#include <system/window.h>
+
+#include "latency_hist.h"
+#include "wrap_trace.h"
+#include "wrap_util.h"
+
+namespace android {
+
+// 經過 2-arg Surface ctor shim 建出來的 Surface 的 frame pacing 量測（opt-in）
+// - persist.vendor.sony.camera.wrap_frame_pacing=1 才開；關著時 shim 只多看一個 static bool
+// - 開著時把該 Surface 的 ANativeWindow::dequeueBuffer / queueBuffer 換成量測版，量完呼叫原本的
+//   （原本的是 libgui 的 static hook，每個 Surface 都一樣；對不上的 window 不動）
+// - 每個 Surface 記：dequeue / queue latency、相鄰兩次 queueBuffer 的間隔（LatencyHist）、
+//   比目標 fps 晚的 frame 數與估計掉的 frame 數
+// - 目標 fps 0 = 不做 pacing 判斷（只記 latency / 間隔）；預設就是 0，一般 30 fps preview 不會被算成 late
+//   JNI 端切進 super-slow 成功時 setTargetFps(實際 fps)，切出或失敗時 setTargetFps(0)
+//   沒有 mode switch 的 process（gateway）要量的話用 persist.vendor.sony.camera.wrap_frame_pacing_fps 給初始值
+// - 有目標時間隔超過 1.5 個週期算 late，另記一筆 kEvFrameLate trace；掉的 frame 數 = round(間隔 / 週期) - 1
+// - Surface 表固定 kMaxSurfaces 格，用 window 指標當 key；滿了蓋掉最早註冊的那格（只影響統計）
+class FramePacing {
+public:
+    static constexpr size_t kMaxSurfaces = 8;
+
+    using DequeueFn = int (*)(ANativeWindow*, ANativeWindowBuffer**, int*);
+    using QueueFn = int (*)(ANativeWindow*, ANativeWindowBuffer*, int);
+
+    struct Slot {
+        std::atomic<ANativeWindow*> window{nullptr};
+        const char* who = nullptr;
+        std::atomic<int64_t> registeredNs{0};
+        std::atomic<int64_t> lastQueueNs{0};
+        std::atomic<uint64_t> frames{0};
+        std::atomic<uint64_t> late{0};
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<uint64_t> dequeueErrors{0};
+        std::atomic<uint64_t> queueErrors{0};
+        LatencyHist dequeue;
+        LatencyHist queue;
+        LatencyHist interval;
+    };
+
+    static bool enabled() {
+        static const bool on = wrap_prop_bool("persist.vendor.sony.camera.wrap_frame_pacing");
+        return on;
+    }
+
+    static FramePacing& get() {
+        static FramePacing* p = new FramePacing();
+        return *p;
+    }
+
+    // shim 呼叫完 3-arg ctor 後呼叫；who 是 dump 裡的標籤（字串常數）
+    static void maybeInstall(ANativeWindow* w, const char* who) {
+        if (enabled() && w) get().install(w, who);
+    }
+
+    // <= 0 關掉 pacing 判斷
+    static void setTargetFps(int fps) {
+        if (!enabled()) return;
+        get().mTargetFps.store(fps > 0 ? fps : 0, std::memory_order_relaxed);
+    }
+
+    // 文字格式：每個 Surface 一行摘要，後面接 dequeue / queue / interval 三行 histogram；回傳 Surface 數，失敗 -1
+    int dump(int fd) {
+        if (fd < 0) return -1;
+        const int64_t now = wrap_now_ns();
+        dprintf(fd, "target_fps=%d\n", mTargetFps.load(std::memory_order_relaxed));
+        dprintf(fd, "window who age_ms frames late dropped dequeue_err queue_err\n");
+        dprintf(fd, "  part count mean_ns p50_ns p90_ns p99_ns p999_ns max_ns\n");
+        int n = 0;
+        for (size_t i = 0; i < kMaxSurfaces; i++) {
+            Slot& s = mSlots[i];
+            ANativeWindow* w = s.window.load(std::memory_order_acquire);
+            if (!w) continue;
+            dprintf(fd, "%p %s %" PRId64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", w,
+                    s.who ? s.who : "?", (now - s.registeredNs.load(std::memory_order_relaxed)) / 1000000,
+                    s.frames.load(std::memory_order_relaxed), s.late.load(std::memory_order_relaxed),
+                    s.dropped.load(std::memory_order_relaxed), s.dequeueErrors.load(std::memory_order_relaxed),
+                    s.queueErrors.load(std::memory_order_relaxed));
+            dumpHist(fd, "dequeue", s.dequeue);
+            dumpHist(fd, "queue", s.queue);
+            dumpHist(fd, "interval", s.interval);
+            n++;
+        }
+        return n;
+    }
+
+private:
+    FramePacing() {
+        const long fps = wrap_prop_long("persist.vendor.sony.camera.wrap_frame_pacing_fps", 0);
+        mTargetFps.store(fps > 0 && fps <= 10000 ? (int)fps : 0, std::memory_order_relaxed);
+    }
+
+    static void dumpHist(int fd, const char* part, const LatencyHist& h) {
+        dprintf(fd, "  %s", part);
+        h.dump(fd);
+        dprintf(fd, "\n");
+    }
+
+    void install(ANativeWindow* w, const char* who) {
+        DequeueFn deq = mOrigDequeue.load(std::memory_order_acquire);
+        QueueFn q = mOrigQueue.load(std::memory_order_acquire);
+        if (!deq) {
+            // 第一個 Surface 的 hook 就是 libgui 的；之後都拿來比對
+            DequeueFn expectDeq = nullptr;
+            QueueFn expectQ = nullptr;
+            mOrigDequeue.compare_exchange_strong(expectDeq, w->dequeueBuffer, std::memory_order_acq_rel);
+            mOrigQueue.compare_exchange_strong(expectQ, w->queueBuffer, std::memory_order_acq_rel);
+            deq = mOrigDequeue.load(std::memory_order_acquire);
+            q = mOrigQueue.load(std::memory_order_acquire);
+        }
+        if (w->dequeueBuffer != deq || w->queueBuffer != q || !deq || !q) {
+            ALOGE("WRAP: frame pacing skipped window=%p (%s): unexpected hooks", w, who);
+            return;
+        }
+
+        Slot* s = claim(w);
+        s->who = who;
+        s->lastQueueNs.store(0, std::memory_order_relaxed);
+        s->frames.store(0, std::memory_order_relaxed);
+        s->late.store(0, std::memory_order_relaxed);
+        s->dropped.store(0, std::memory_order_relaxed);
+        s->dequeueErrors.store(0, std::memory_order_relaxed);
+        s->queueErrors.store(0, std::memory_order_relaxed);
+        s->dequeue.reset();
+        s->queue.reset();
+        s->interval.reset();
+        s->registeredNs.store(wrap_now_ns(), std::memory_order_relaxed);
+        s->window.store(w, std::memory_order_release);
+
+        w->dequeueBuffer = hookDequeue;
+        w->queueBuffer = hookQueue;
+    }
+
+    // 同一個 window（位址被新 Surface 重用）→ 空格 → 最早註冊的
+    Slot* claim(ANativeWindow* w) {
+        Slot* oldest = &mSlots[0];
+        for (size_t i = 0; i < kMaxSurfaces; i++) {
+            Slot& s = mSlots[i];
+            ANativeWindow* cur = s.window.load(std::memory_order_acquire);
+            if (cur == w) return &s;
+            if (!cur) {
+                ANativeWindow* expected = nullptr;
+                if (s.window.compare_exchange_strong(expected, w, std::memory_order_acq_rel)) return &s;
+                continue;
+            }
+            if (s.registeredNs.load(std::memory_order_relaxed) < oldest->registeredNs.load(std::memory_order_relaxed))
+                oldest = &s;
+        }
+        return oldest;
+    }
+
+    Slot* find(ANativeWindow* w) {
+        for (size_t i = 0; i < kMaxSurfaces; i++) {
+            if (mSlots[i].window.load(std::memory_order_acquire) == w) return &mSlots[i];
+        }
+        return nullptr;
+    }
+
+    static int hookDequeue(ANativeWindow* w, ANativeWindowBuffer** buffer, int* fenceFd) {
+        FramePacing& p = get();
+        const int64_t t0 = wrap_now_ns();
+        const int r = p.mOrigDequeue.load(std::memory_order_relaxed)(w, buffer, fenceFd);
+        const int64_t t1 = wrap_now_ns();
+        if (Slot* s = p.find(w)) {
+            s->dequeue.add(t1 - t0);
+            if (r != 0) s->dequeueErrors.fetch_add(1, std::memory_order_relaxed);
+        }
+        return r;
+    }
+
+    static int hookQueue(ANativeWindow* w, ANativeWindowBuffer* buffer, int fenceFd) {
+        FramePacing& p = get();
+        const int64_t t0 = wrap_now_ns();
+        const int r = p.mOrigQueue.load(std::memory_order_relaxed)(w, buffer, fenceFd);
+        const int64_t t1 = wrap_now_ns();
+        Slot* s = p.find(w);
+        if (!s) return r;
+
+        s->queue.add(t1 - t0);
+        if (r != 0) {
+            s->queueErrors.fetch_add(1, std::memory_order_relaxed);
+            return r;
+        }
+        s->frames.fetch_add(1, std::memory_order_relaxed);
+
+        // 間隔從 caller 交出 buffer 的時間點算，queue 本身的 latency 另外記
+        const int64_t prev = s->lastQueueNs.exchange(t0, std::memory_order_relaxed);
+        if (prev == 0) return r;
+        const int64_t interval = t0 - prev;
+        s->interval.add(interval);
+
+        const int fps = p.mTargetFps.load(std::memory_order_relaxed);
+        if (fps <= 0) return r;
+        const int64_t period = 1000000000LL / fps;
+        if (interval * 2 > period * 3) {
+            const int64_t missed = (interval + period / 2) / period - 1;
+            s->late.fetch_add(1, std::memory_order_relaxed);
+            if (missed > 0) s->dropped.fetch_add((uint64_t)missed, std::memory_order_relaxed);
+            wrap_trace(wraptrace::kEvFrameLate, 0, __builtin_return_address(0), (uint64_t)interval,
+                       ((uint64_t)(uint32_t)fps << 32) | (uint32_t)(missed > 0 ? missed : 0), t1 - t0);
+        }
+        return r;
+    }
+
+    Slot mSlots[kMaxSurfaces];
+    std::atomic<DequeueFn> mOrigDequeue{nullptr};
+    std::atomic<QueueFn> mOrigQueue{nullptr};
+    std::atomic<int> mTargetFps{0};
+};
+
+} // namespace android
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <binder/IMemory.h>
+#include <binder/MemoryBase.h>
+#include <binder/MemoryHeapBase.h>
+#include <utils/RefBase.h>
+#include <utils/StrongPointer.h>
+
+#include "alloc_stats.h"
+#include "arena_free_list.h"
+#include "wrap_util.h"
+
+namespace android {
+
+// 小 allocation 的 arena：從少數幾個大 heap 切 offset-based MemoryBase 出去，
+// 省掉每次一個 ashmem fd / mmap，binder 也只需要傳同一個 heap fd。
+// - 每個 owner（client 端固定 0；service 端用 calling pid）一組 chunk，
+//   不同 client 的資料不會落在同一個 heap（對端 map 的是整個 heap）
+// - chunk 內 first-fit free list，釋放時合併相鄰區塊；ArenaMemory dtor 時歸還（見 arena_free_list.h）
+// - chunk 的 high-water 以上從沒借出過，保證是 0；重用區塊只清 high-water 以下的部分
+// - 全空的 chunk 只留一個，其餘直接放掉
+// 對端拿到的 IMemory offset 不是 0、heap 也比 size 大，closed-source 的對端還沒驗過，
+// 所以預設關著：persist.vendor.sony.camera.wrap_alloc_arena=1 才開（跟 wrap_alloc_memfd 一樣）
+class HeapArena {
+public:
+    static constexpr size_t kChunkSize = 1024 * 1024;
+    static constexpr size_t kMaxAlloc  = 64 * 1024;
+    static constexpr size_t kAlign     = 64;
+    static constexpr size_t kMaxChunks = 8; // 每個 owner
+
+    struct Chunk : public LightRefBase<Chunk> {
+        sp<MemoryHeapBase> heap;
+        ArenaFreeList space{kChunkSize};
+        size_t live = 0;
+    };
+
+    struct Block {
+        sp<Chunk> chunk;
+        size_t offset = 0;
+        size_t size = 0;
+        size_t dirty = 0; // [offset, offset+dirty) 可能不是 0
+    };
+
+    static bool enabled() {
+        static const bool on = wrap_prop_bool("persist.vendor.sony.camera.wrap_alloc_arena");
+        return on;
+    }
+
+    static HeapArena& get() {
+        static HeapArena* arena = new HeapArena();
+        return *arena;
+    }
+
+    static size_t roundUp(size_t size) { return (size + kAlign - 1) & ~(kAlign - 1); }
+
+    // 失敗（太大 / chunk 用完 / 建 heap 失敗）回空的 Block，caller 改走一般路徑
+    Block allocate(int owner, size_t size) {
+        Block out;
+        if (size == 0 || size > kMaxAlloc) return out;
+        const size_t need = roundUp(size);
+
+        std::lock_guard<std::mutex> _l(mLock);
+        std::vector<sp<Chunk>>& chunks = mOwners[owner];
+        for (const sp<Chunk>& c : chunks) {
+            if (carveLocked(c, need, out)) return out;
+        }
+        if (chunks.size() >= kMaxChunks) return out;
+
+        sp<Chunk> c(new (std::nothrow) Chunk());
+        if (c == nullptr) return out;
+        c->heap = new (std::nothrow) MemoryHeapBase(kChunkSize, 0, "wrap-arena");
+        if (c->heap == nullptr || c->heap->getHeapID() < 0 || c->heap->getBase() == MAP_FAILED) return out;
+        chunks.push_back(c);
+        carveLocked(c, need, out);
+        return out;
+    }
+
+    void release(int owner, const sp<Chunk>& c, size_t offset, size_t size) {
+        sp<Chunk> victim; // lock 外才 release heap
+        std::lock_guard<std::mutex> _l(mLock);
+        c->space.release(offset, roundUp(size));
+        c->live--;
+
+        if (c->live == 0) {
+            std::vector<sp<Chunk>>& chunks = mOwners[owner];
+            size_t empty = 0;
+            for (const sp<Chunk>& o : chunks) empty += (o->live == 0) ? 1 : 0;
+            if (empty > 1) {
+                for (size_t i = 0; i < chunks.size(); i++) {
+                    if (chunks[i] == c) {
+                        victim = chunks[i];
+                        chunks.erase(chunks.begin() + (long)i);
+                        break;
+                    }
+                }
+            }
+            if (chunks.empty()) mOwners.erase(owner);
+        }
+    }
+
+private:
+    HeapArena() = default;
+
+    bool carveLocked(const sp<Chunk>& c, size_t need, Block& out) {
+        size_t off = 0;
+        size_t dirty = 0;
+        if (!c->space.carve(need, &off, &dirty)) return false;
+        c->live++;
+        out.chunk = c;
+        out.offset = off;
+        out.size = need;
+        out.dirty = dirty;
+        return true;
+    }
+
+    std::mutex mLock;
+    std::map<int, std::vector<sp<Chunk>>> mOwners;
+};
+
+// dtor 時把區塊還給 HeapArena 的 MemoryBase
+class ArenaMemory : public MemoryBase {
+public:
+    ArenaMemory(int owner, const HeapArena::Block& b, size_t size)
+        : MemoryBase(b.chunk->heap, (ssize_t)b.offset, size), mOwner(owner), mChunk(b.chunk), mOffset(b.offset),
+          mSize(b.size) {}
+
+    ~ArenaMemory() override { HeapArena::get().release(mOwner, mChunk, mOffset, mSize); }
+
+    AllocTicket ticket; // AllocStats 的帳（見 alloc_stats.h）
+
+private:
+    const int mOwner;
+    sp<HeapArena::Chunk> mChunk;
+    const size_t mOffset;
+    const size_t mSize;
+};
+
+} // namespace android
@@ -0,0 +1,315 @@
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <binder/IMemory.h>
+#include <binder/MemoryBase.h>
+#include <binder/MemoryHeapBase.h>
+#include <log/log.h>
+#include <utils/StrongPointer.h>
+
+#include "alloc_stats.h"
+#include "heap_size_class.h"
+#include "memfd_heap.h"
+#include "prefault.h"
+#include "wrap_util.h"
+
+namespace android {
+
+// 回收用的 MemoryHeapBase pool：
+// - 依 2 的冪次分 size class（4 KiB .. 8 MiB，見 heap_size_class.h），比這大的直接 new 不進 pool
+// - 整個 pool 快取的 bytes 有上限，超過就丟最舊的
+// - 閒置超過 kIdleTrimNs 的 heap 由背景 thread 釋放（trim-on-idle）
+// - heap 只有在 pool 自己是唯一持有者（getStrongCount()==1）時才會再借出，
+//   對端 process 還 map 著（binder 仍持有 strong ref）的 heap 一律丟掉
+// - 每個 heap 記 dirty high-water：曾借出過的最大 window，重用時只需清這段
+// - ashmem / memfd 兩種後端分開快取，不會把 A 借給要 B 的 caller
+// - reserve()：預先建好一批剛好某個 size 的 heap（例如 super-slow burst；不進 size class，不會放大），
+//   總量不超過 kMaxReservedBytes，不受 cache 上限 / idle trim 影響；
+//   同 size 的 acquire 優先從這裡拿；借出去的 reserved heap 逐一記下來，還回來時只有記過的那幾個回 reservation
+//   （不看 size：同 size 的 class heap 不會被收進來），直到 releaseReservation()
+enum HeapBackend : unsigned {
+    kHeapAshmem   = 0,
+    kHeapMemfd    = 1,
+    kHeapBackends = 2,
+};
+
+class HeapPool {
+public:
+    static constexpr unsigned kMinClassShift = HeapSizeClass::kMinShift;
+    static constexpr unsigned kMaxClassShift = HeapSizeClass::kMaxShift;
+    static constexpr unsigned kNumClasses    = HeapSizeClass::kCount;
+    static constexpr size_t   kMaxCachedBytes = 32UL * 1024UL * 1024UL;
+    static constexpr size_t   kMaxReservedBytes = kMaxCachedBytes;
+    static constexpr int64_t  kIdleTrimNs     = 5LL * 1000000000LL;
+
+    struct Lease {
+        sp<MemoryHeapBase> heap;
+        int fresh = 0;    // 1 = 剛從 kernel 拿到的 mapping（ashmem 保證全 0）
+        size_t dirty = 0; // [0, dirty) 可能殘留上一個使用者寫的資料
+    };
+
+    static HeapPool& get() {
+        // 故意 leak：避免 exit 時 static dtor 跟 trim thread / binder thread 搶
+        static HeapPool* pool = new HeapPool();
+        return *pool;
+    }
+
+    // size 超過最大 class 回傳 -1（不走 pool）
+    static int classOf(size_t size) { return HeapSizeClass::of(size); }
+
+    static size_t classSize(int cls) { return HeapSizeClass::size(cls); }
+
+    Lease acquire(size_t size, HeapBackend backend = kHeapAshmem) {
+        Lease out;
+        const int cls = classOf(size);
+        std::vector<sp<MemoryHeapBase>> victims; // 在 lock 外 release（munmap/close）
+        if (backend == kHeapAshmem) {
+            std::lock_guard<std::mutex> _l(mLock);
+            if (mReservedSize != 0 && size == mReservedSize) {
+                while (!mReservedFree.empty()) {
+                    Entry e = mReservedFree.back();
+                    mReservedFree.pop_back();
+                    if (e.heap->getStrongCount() == 1) {
+                        out.heap = e.heap;
+                        out.dirty = e.dirty;
+                        mReservedLent.push_back(e.heap.get());
+                        break;
+                    }
+                    victims.push_back(e.heap); // 對端還拿著，reservation 就少一個
+                }
+                if (out.heap != nullptr) return out;
+            }
+        }
+        if (cls >= 0) {
+            {
+                std::lock_guard<std::mutex> _l(mLock);
+                std::vector<Entry>& list = mFree[backend][cls];
+                while (!list.empty()) {
+                    Entry e = list.back();
+                    list.pop_back();
+                    mCachedBytes -= classSize(cls);
+                    if (e.heap->getStrongCount() == 1) {
+                        out.heap = e.heap;
+                        out.dirty = e.dirty;
+                        break;
+                    }
+                    victims.push_back(e.heap);
+                }
+            }
+            if (out.heap != nullptr) return out;
+        }
+
+        const size_t heapSize = (cls >= 0) ? classSize(cls) : size;
+        sp<MemoryHeapBase> heap;
+        if (backend == kHeapMemfd)
+            heap = make_memfd_heap(heapSize, "wrap-memfd");
+        else
+            heap = new (std::nothrow) MemoryHeapBase(heapSize, 0, nullptr);
+        if (heap == nullptr || heap->getHeapID() < 0 || heap->getBase() == MAP_FAILED) return out;
+        out.heap = heap;
+        out.fresh = 1;
+        return out;
+    }
+
+    // 使用者放掉 MemoryBase 時呼叫；不檢查 strong count，借出時才檢查
+    // dirty: 這個 heap 目前可能非 0 的前綴長度
+    void recycle(const sp<MemoryHeapBase>& heap, size_t dirty, HeapBackend backend = kHeapAshmem) {
+        if (heap == nullptr) return;
+        if (backend == kHeapAshmem) {
+            std::lock_guard<std::mutex> _l(mLock);
+            for (size_t i = 0; i < mReservedLent.size(); i++) {
+                if (mReservedLent[i] != heap.get()) continue;
+                mReservedLent[i] = mReservedLent.back();
+                mReservedLent.pop_back();
+                mReservedFree.push_back(Entry{heap, wrap_now_ns(), dirty});
+                return;
+            }
+        }
+        const int cls = classOf(heap->getSize());
+        if (cls < 0 || classSize(cls) != heap->getSize()) return;
+
+        std::vector<sp<MemoryHeapBase>> victims;
+        bool startTrim = false;
+        {
+            std::lock_guard<std::mutex> _l(mLock);
+            const int64_t now = wrap_now_ns();
+            mFree[backend][cls].push_back(Entry{heap, now, dirty});
+            mCachedBytes += classSize(cls);
+            evictOverBudgetLocked(victims);
+            if (!mTrimRunning && mCachedBytes > 0) {
+                mTrimRunning = true;
+                startTrim = true;
+            }
+        }
+        if (startTrim) startTrimThread();
+    }
+
+    // 丟掉閒置超過 idleNs 的 heap；回傳釋放的 bytes
+    size_t trim(int64_t idleNs) {
+        std::vector<sp<MemoryHeapBase>> victims;
+        size_t freed = 0;
+        {
+            std::lock_guard<std::mutex> _l(mLock);
+            const int64_t now = wrap_now_ns();
+            for (unsigned b = 0; b < kHeapBackends; b++) {
+                for (unsigned c = 0; c < kNumClasses; c++) {
+                    std::vector<Entry>& list = mFree[b][c];
+                    size_t keep = 0;
+                    for (size_t i = 0; i < list.size(); i++) {
+                        if (now - list[i].idleSinceNs >= idleNs) {
+                            victims.push_back(list[i].heap);
+                            freed += classSize((int)c);
+                        } else {
+                            list[keep++] = list[i];
+                        }
+                    }
+                    list.resize(keep);
+                }
+            }
+            mCachedBytes -= freed;
+        }
+        return freed;
+    }
+
+    // 預先建 count 個剛好 size bytes 的 ashmem heap（先放掉舊的 reservation）；prefault 時先 fault-in（見 prefault.h）
+    // 總量夾在 kMaxReservedBytes；回傳實際 reserve 的 bytes（size * 個數）
+    size_t reserve(size_t size, size_t count, bool prefault) {
+        releaseReservation();
+        if (size == 0 || size > kMaxReservedBytes) return 0;
+        if (count > kMaxReservedBytes / size) count = kMaxReservedBytes / size;
+        {
+            std::lock_guard<std::mutex> _l(mLock);
+            mReservedSize = size;
+        }
+        size_t made = 0;
+        for (; made < count; made++) {
+            sp<MemoryHeapBase> heap(new (std::nothrow) MemoryHeapBase(size, 0, nullptr));
+            if (heap == nullptr || heap->getHeapID() < 0 || heap->getBase() == MAP_FAILED) break;
+            if (prefault) wrap_prefault(heap->getBase(), size, nullptr);
+            std::lock_guard<std::mutex> _l(mLock);
+            if (mReservedSize != size) break; // 建到一半被 releaseReservation() 了
+            mReservedFree.push_back(Entry{heap, wrap_now_ns(), 0});
+        }
+        return made * size;
+    }
+
+    // 放掉所有還沒借出的 reserved heap；借出中的還回來時照一般規則（size 不是 class 大小就直接放掉）
+    // 回傳放掉的 bytes
+    size_t releaseReservation() {
+        std::vector<sp<MemoryHeapBase>> victims;
+        size_t freed = 0;
+        {
+            std::lock_guard<std::mutex> _l(mLock);
+            for (Entry& e : mReservedFree) victims.push_back(e.heap);
+            freed = mReservedFree.size() * mReservedSize;
+            mReservedFree.clear();
+            mReservedLent.clear();
+            mReservedSize = 0;
+        }
+        return freed;
+    }
+
+    size_t reservedSize() {
+        std::lock_guard<std::mutex> _l(mLock);
+        return mReservedSize;
+    }
+
+    size_t cachedBytes() {
+        std::lock_guard<std::mutex> _l(mLock);
+        return mCachedBytes;
+    }
+
+private:
+    struct Entry {
+        sp<MemoryHeapBase> heap;
+        int64_t idleSinceNs;
+        size_t dirty;
+    };
+
+    HeapPool() = default;
+
+    // 超過 kMaxCachedBytes：從最舊的 entry 開始丟
+    void evictOverBudgetLocked(std::vector<sp<MemoryHeapBase>>& victims) {
+        while (mCachedBytes > kMaxCachedBytes) {
+            int oldestCls = -1;
+            unsigned oldestBackend = 0;
+            int64_t oldest = 0;
+            for (unsigned b = 0; b < kHeapBackends; b++) {
+                for (unsigned c = 0; c < kNumClasses; c++) {
+                    if (mFree[b][c].empty()) continue;
+                    const int64_t t = mFree[b][c].front().idleSinceNs;
+                    if (oldestCls < 0 || t < oldest) {
+                        oldestCls = (int)c;
+                        oldestBackend = b;
+                        oldest = t;
+                    }
+                }
+            }
+            if (oldestCls < 0) break;
+            std::vector<Entry>& list = mFree[oldestBackend][oldestCls];
+            victims.push_back(list.front().heap);
+            list.erase(list.begin());
+            mCachedBytes -= classSize(oldestCls);
+        }
+    }
+
+    static void* trimThreadMain(void* arg) {
+        HeapPool* self = static_cast<HeapPool*>(arg);
+        while (true) {
+            usleep((useconds_t)(kIdleTrimNs / 1000));
+            self->trim(kIdleTrimNs);
+            std::lock_guard<std::mutex> _l(self->mLock);
+            if (self->mCachedBytes == 0) {
+                self->mTrimRunning = false;
+                return nullptr;
+            }
+        }
+    }
+
+    void startTrimThread() {
+        pthread_t t;
+        if (pthread_create(&t, nullptr, trimThreadMain, this) == 0) {
+            pthread_detach(t);
+        } else {
+            std::lock_guard<std::mutex> _l(mLock);
+            mTrimRunning = false;
+        }
+    }
+
+    std::mutex mLock;
+    std::vector<Entry> mFree[kHeapBackends][kNumClasses];
+    size_t mReservedSize = 0; // 0 = 沒有 reservation
+    std::vector<Entry> mReservedFree;
+    // 借出中的 reserved heap（借出期間 PooledMemory 持有 strong ref，指標不會被重用）
+    std::vector<const MemoryHeapBase*> mReservedLent;
+    size_t mCachedBytes = 0;
+    bool mTrimRunning = false;
+};
+
+// dtor 時把 heap 還給 HeapPool 的 MemoryBase
+// dirty 只記到 window 為止：對端雖然 map 整個 heap，但只被允許寫 MemoryBase 的範圍
+class PooledMemory : public MemoryBase {
+public:
+    PooledMemory(const sp<MemoryHeapBase>& heap, size_t size, size_t dirty, HeapBackend backend = kHeapAshmem)
+        : MemoryBase(heap, 0, size), mPoolHeap(heap), mDirty(dirty > size ? dirty : size), mBackend(backend) {}
+
+    ~PooledMemory() override { HeapPool::get().recycle(mPoolHeap, mDirty, mBackend); }
+
+    AllocTicket ticket; // AllocStats 的帳（見 alloc_stats.h）
+
+private:
+    sp<MemoryHeapBase> mPoolHeap;
+    size_t mDirty;
+    HeapBackend mBackend;
+};
+
+} // namespace android
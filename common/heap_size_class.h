@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace android {
+
+// HeapPool 的 size class：2 的冪次，4 KiB .. 8 MiB（不碰 binder，host test 直接用）
+struct HeapSizeClass {
+    static constexpr unsigned kMinShift = 12; // 4 KiB
+    static constexpr unsigned kMaxShift = 23; // 8 MiB
+    static constexpr unsigned kCount    = kMaxShift - kMinShift + 1;
+
+    // 放得下 size 的最小 class；超過最大 class 回傳 -1（不走 pool）
+    static int of(size_t size) {
+        size_t cls = (size_t)1 << kMinShift;
+        for (unsigned i = 0; i < kCount; i++, cls <<= 1) {
+            if (size <= cls) return (int)i;
+        }
+        return -1;
+    }
+
+    static size_t size(int cls) { return (size_t)1 << (kMinShift + (unsigned)cls); }
+};
+
+} // namespace android
@@ -0,0 +1,326 @@
+#pragma once
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <new>
+#include <string>
+
+#if defined(__BIONIC__)
+#include <sys/system_properties.h>
+#else
+struct prop_info;
+#endif
+
+#include "wrap_util.h"
+#include "wrap_worker_pool.h"
+
+namespace android {
+
+// 一條 latency histogram（HdrHistogram 式 log-linear bucket）
+// - < 16 ns 每 ns 一格；之後每個 2 的冪次區間切 16 格，相對誤差 < 6.25%
+// - 上限 2^40 ns（約 18 分鐘），再大的算最後一格
+// - 全部 relaxed atomic，記一筆是幾個 fetch_add
+class LatencyHist {
+public:
+    static constexpr unsigned kSubBits = 4;
+    static constexpr unsigned kSub = 1u << kSubBits;
+    static constexpr unsigned kMaxBits = 40;
+    static constexpr unsigned kBuckets = (kMaxBits - kSubBits + 1) * kSub;
+
+    LatencyHist() { reset(); }
+
+    // 跟 add 同時跑時可能留下幾筆舊的，只給「整條換人用」的場合
+    void reset() {
+        for (unsigned i = 0; i < kBuckets; i++) mCounts[i].store(0, std::memory_order_relaxed);
+        mCount.store(0, std::memory_order_relaxed);
+        mSum.store(0, std::memory_order_relaxed);
+        mMax.store(0, std::memory_order_relaxed);
+    }
+
+    static unsigned bucketOf(uint64_t v) {
+        if (v < kSub) return (unsigned)v;
+        const unsigned msb = 63u - (unsigned)__builtin_clzll(v);
+        if (msb >= kMaxBits) return kBuckets - 1;
+        const unsigned g = msb - kSubBits + 1;
+        return g * kSub + (unsigned)((v >> (msb - kSubBits)) & (kSub - 1));
+    }
+
+    // bucket 內最大的值（percentile 取保守的一端）
+    static uint64_t bucketHigh(unsigned idx) {
+        const unsigned g = idx / kSub;
+        const uint64_t sub = idx % kSub;
+        if (g == 0) return sub;
+        const uint64_t width = 1ULL << (g - 1);
+        return ((kSub + sub) << (g - 1)) + width - 1;
+    }
+
+    void add(int64_t ns) {
+        const uint64_t v = ns > 0 ? (uint64_t)ns : 0;
+        mCounts[bucketOf(v)].fetch_add(1, std::memory_order_relaxed);
+        mCount.fetch_add(1, std::memory_order_relaxed);
+        mSum.fetch_add(v, std::memory_order_relaxed);
+        uint64_t max = mMax.load(std::memory_order_relaxed);
+        while (v > max && !mMax.compare_exchange_weak(max, v, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t count() const { return mCount.load(std::memory_order_relaxed); }
+
+    // 依序填 p50 / p90 / p99 / p99.9（ns）；跟 add 同時跑時是近似值
+    void percentiles(uint64_t out[4]) const {
+        static const uint32_t kPermille[4] = {500, 900, 990, 999};
+        uint64_t total = 0;
+        for (unsigned i = 0; i < kBuckets; i++) total += mCounts[i].load(std::memory_order_relaxed);
+        unsigned q = 0;
+        uint64_t seen = 0;
+        for (unsigned i = 0; i < kBuckets && q < 4; i++) {
+            seen += mCounts[i].load(std::memory_order_relaxed);
+            while (q < 4 && total && seen * 1000 >= total * kPermille[q]) out[q++] = bucketHigh(i);
+        }
+        for (; q < 4; q++) out[q] = 0;
+    }
+
+    // "count mean p50 p90 p99 p999 max"（ns）
+    void dump(int fd) const {
+        uint64_t p[4];
+        percentiles(p);
+        const uint64_t n = count();
+        const uint64_t mean = n ? mSum.load(std::memory_order_relaxed) / n : 0;
+        const uint64_t max = mMax.load(std::memory_order_relaxed);
+        // bucket 上緣可能超過實際最大值
+        for (unsigned i = 0; i < 4; i++) {
+            if (p[i] > max) p[i] = max;
+        }
+        dprintf(fd, " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64, n, mean, p[0],
+                p[1], p[2], p[3], max);
+    }
+
+private:
+    std::atomic<uint32_t> mCounts[kBuckets];
+    std::atomic<uint64_t> mCount{0};
+    std::atomic<uint64_t> mSum{0};
+    std::atomic<uint64_t> mMax{0};
+};
+
+// 每個 wrapped entry point 一個 probe，三條 histogram：
+// - total：整個 entry point
+// - real：花在 real library / cacao service 的時間（LatencyRealSection 包起來的部分）
+// - self：total - real，也就是 wrapper 自己的 overhead
+// probe 表固定 kMaxProbes 格、用到才配置，滿了算進最後一格 "(other)"
+// persist.vendor.sony.camera.wrap_latency=0 整個關掉（預設開，每次呼叫多兩次 clock_gettime）
+// dump：各 wrapper export 的 <lib>_wrapper_latency_dump(fd)，或
+//       setprop debug.vendor.sony.camera.wrap_latency_dump <dir>：記錄時每個 library 最多每秒看一次 property，
+//       值有變就在背景寫 <dir>/<library>.<pid>.latency（SELinux 要允許寫該目錄）
+class LatencyStats {
+public:
+    static constexpr size_t kMaxProbes = 24;
+    static constexpr const char* kTriggerProp = "debug.vendor.sony.camera.wrap_latency_dump";
+
+    struct Probe {
+        explicit Probe(const char* n) : name(n) {}
+        const char* const name;
+        LatencyHist total;
+        LatencyHist real;
+        LatencyHist self;
+    };
+
+    static LatencyStats& get() {
+        static LatencyStats* s = new LatencyStats();
+        return *s;
+    }
+
+    static bool enabled() {
+        static const bool on = wrap_prop_long("persist.vendor.sony.camera.wrap_latency", 1) != 0;
+        return on;
+    }
+
+    // name 通常是字串常數：先比指標，不同 TU 的同字串再 strcmp 一次
+    Probe* probe(const char* name) {
+        if (!name) name = "(null)";
+        for (size_t i = 0; i < kMaxProbes - 1; i++) {
+            Probe* cur = mProbes[i].load(std::memory_order_acquire);
+            if (cur == nullptr) {
+                Probe* mine = new (std::nothrow) Probe(name);
+                if (!mine) return nullptr;
+                if (mProbes[i].compare_exchange_strong(cur, mine, std::memory_order_acq_rel)) return mine;
+                delete mine; // 別人剛搶走這格；cur 已更新成對方的 probe
+            }
+            if (cur->name == name || strcmp(cur->name, name) == 0) return cur;
+        }
+        return other();
+    }
+
+    void record(Probe* p, int64_t totalNs, int64_t realNs, bool sawReal) {
+        p->total.add(totalNs);
+        if (sawReal) p->real.add(realNs);
+        p->self.add(totalNs - realNs);
+        pollTrigger();
+    }
+
+    // 文字格式，一行一條 histogram（沒有 real 的 probe 只印 total）；回傳寫出的 probe 數，失敗 -1
+    int dump(int fd) {
+        if (fd < 0) return -1;
+        dprintf(fd, "probe part count mean_ns p50_ns p90_ns p99_ns p999_ns max_ns\n");
+        int n = 0;
+        for (size_t i = 0; i < kMaxProbes; i++) {
+            const Probe* p = mProbes[i].load(std::memory_order_acquire);
+            if (!p || !p->total.count()) continue;
+            dumpPart(fd, p->name, "total", p->total);
+            if (p->real.count()) {
+                dumpPart(fd, p->name, "real", p->real);
+                dumpPart(fd, p->name, "self", p->self);
+            }
+            n++;
+        }
+        return n;
+    }
+
+private:
+    LatencyStats() {
+#if defined(__BIONIC__)
+        const prop_info* pi = __system_property_find(kTriggerProp);
+        // process 起來前就設好的值不算觸發
+        if (pi) mTriggerSerial = __system_property_serial(pi);
+        mTriggerProp.store(pi, std::memory_order_relaxed);
+#endif
+    }
+
+    Probe* other() {
+        Probe* cur = mProbes[kMaxProbes - 1].load(std::memory_order_acquire);
+        if (cur) return cur;
+        Probe* mine = new (std::nothrow) Probe("(other)");
+        if (!mine) return nullptr;
+        if (mProbes[kMaxProbes - 1].compare_exchange_strong(cur, mine, std::memory_order_acq_rel)) return mine;
+        delete mine;
+        return cur;
+    }
+
+    static void dumpPart(int fd, const char* name, const char* part, const LatencyHist& h) {
+        dprintf(fd, "%s %s", name, part);
+        h.dump(fd);
+        dprintf(fd, "\n");
+    }
+
+    // 這個 header 被 inline 進哪個 .so，dump 檔就用那個名字
+    static std::string libraryName() {
+        Dl_info info;
+        if (dladdr(reinterpret_cast<void*>(&LatencyStats::get), &info) && info.dli_fname) {
+            const char* slash = strrchr(info.dli_fname, '/');
+            return slash ? slash + 1 : info.dli_fname;
+        }
+        return "wrapper";
+    }
+
+    // host（test）上沒有 property，不會觸發
+    void pollTrigger() {
+#if defined(__BIONIC__)
+        const int64_t now = wrap_now_ns();
+        int64_t last = mLastPollNs.load(std::memory_order_relaxed);
+        if (now - last < 1000000000LL) return;
+        if (!mLastPollNs.compare_exchange_strong(last, now, std::memory_order_relaxed)) return;
+
+        const prop_info* pi = mTriggerProp.load(std::memory_order_relaxed);
+        if (!pi) {
+            pi = __system_property_find(kTriggerProp);
+            if (!pi) return;
+            mTriggerProp.store(pi, std::memory_order_relaxed);
+        }
+        // 只有搶到 mLastPollNs 的 thread 會走到這裡，mTriggerSerial 不用另外鎖
+        const uint32_t serial = __system_property_serial(pi);
+        if (serial == mTriggerSerial) return;
+        mTriggerSerial = serial;
+
+        char dir[PROP_VALUE_MAX] = {0};
+        if (__system_property_get(kTriggerProp, dir) <= 0) return;
+        const std::string path =
+            std::string(dir) + "/" + libraryName() + "." + std::to_string((int)getpid()) + ".latency";
+
+        static WrapWorkerPool* pool = new WrapWorkerPool("wrap-latency", 1, 10);
+        pool->post([this, path]() {
+            const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                ALOGE("WRAP: latency dump open(%s) failed", path.c_str());
+                return;
+            }
+            dump(fd);
+            ::close(fd);
+        });
+#endif
+    }
+
+    std::atomic<Probe*> mProbes[kMaxProbes] = {};
+    std::atomic<int64_t> mLastPollNs{0};
+    std::atomic<const prop_info*> mTriggerProp{nullptr};
+    uint32_t mTriggerSerial = 0;
+};
+
+// entry point 開頭放一個；巢狀時各自記，real 時間只算進最內層
+// probe 用 function-local static 快取：static LatencyStats::Probe* const p = LatencyStats::get().probe("...");
+class LatencyScope {
+public:
+    explicit LatencyScope(LatencyStats::Probe* p) : mProbe(LatencyStats::enabled() ? p : nullptr) {
+        if (!mProbe) return;
+        mPrev = current();
+        current() = this;
+        mStartNs = wrap_now_ns();
+    }
+    LatencyScope(const LatencyScope&) = delete;
+    LatencyScope& operator=(const LatencyScope&) = delete;
+    ~LatencyScope() {
+        if (!mProbe) return;
+        const int64_t total = wrap_now_ns() - mStartNs;
+        current() = mPrev;
+        LatencyStats::get().record(mProbe, total, mRealNs, mSawReal);
+    }
+
+    static LatencyScope*& current() {
+        static thread_local LatencyScope* s = nullptr;
+        return s;
+    }
+
+private:
+    friend class LatencyRealSection;
+
+    LatencyStats::Probe* const mProbe;
+    LatencyScope* mPrev = nullptr;
+    int64_t mStartNs = 0;
+    int64_t mRealNs = 0;
+    int mRealDepth = 0;
+    bool mSawReal = false;
+};
+
+// 包住呼叫 real library / service 的那段；不在 LatencyScope 裡時什麼都不做，巢狀只算外層
+class LatencyRealSection {
+public:
+    LatencyRealSection() : mScope(LatencyScope::current()) {
+        if (mScope && mScope->mRealDepth++ == 0) mStartNs = wrap_now_ns();
+    }
+    LatencyRealSection(const LatencyRealSection&) = delete;
+    LatencyRealSection& operator=(const LatencyRealSection&) = delete;
+    ~LatencyRealSection() {
+        if (!mScope || --mScope->mRealDepth != 0) return;
+        mScope->mRealNs += wrap_now_ns() - mStartNs;
+        mScope->mSawReal = true;
+    }
+
+private:
+    LatencyScope* const mScope;
+    int64_t mStartNs = 0;
+};
+
+// latency_real([&] { return real(...); })：一個呼叫算成 real 時間
+template <typename F>
+static inline auto latency_real(F&& f) -> decltype(f()) {
+    LatencyRealSection _r;
+    return f();
+}
+
+} // namespace android
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <new>
+
+#include <binder/IMemory.h>
+#include <binder/MemoryHeapBase.h>
+#include <utils/StrongPointer.h>
+
+#include "memfd_util.h"
+
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE 14
+#endif
+
+namespace android {
+
+// memfd 後端（取代預設的 ashmem MemoryHeapBase）；fd 的建立 / seal 在 memfd_util.h
+// - >= 2 MiB 的 mapping 標 MADV_HUGEPAGE（shmem_enabled=advise 時才真的用 THP）
+static constexpr size_t kMemfdHugeMin = 2UL * 1024UL * 1024UL;
+
+static inline sp<MemoryHeapBase> make_memfd_heap(size_t size, const char* name) {
+    sp<MemoryHeapBase> heap;
+    int fd = wrap_memfd_create(name, size);
+    if (fd < 0) return heap;
+    // MemoryHeapBase(fd, ...) 會 dup 一份，自己的這份關掉
+    heap = new (std::nothrow) MemoryHeapBase(fd, size, 0, 0);
+    ::close(fd);
+    if (heap == nullptr || heap->getHeapID() < 0 || heap->getBase() == MAP_FAILED) return sp<MemoryHeapBase>();
+    if (size >= kMemfdHugeMin) madvise(heap->getBase(), size, MADV_HUGEPAGE);
+    return heap;
+}
+
+} // namespace android
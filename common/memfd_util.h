@@ -0,0 +1,48 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// 舊 NDK / glibc header 可能沒有這些
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS (1024 + 9)
+#define F_GET_SEALS (1024 + 10)
+#endif
+#ifndef F_SEAL_SEAL
+#define F_SEAL_SEAL   0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW   0x0004
+#define F_SEAL_WRITE  0x0008
+#endif
+
+namespace android {
+
+// memfd 的建立（不依賴 binder，host test 直接用；MemoryHeapBase 的包裝在 memfd_heap.h）
+// - 建立時就封住 SHRINK / GROW：對端 map 之後大小不會再變，不用擔心 SIGBUS，
+//   也就不必為了防守先 copy 一份
+// 只用 Linux syscall，一般 Linux host 上也能跑 / 測
+static constexpr int kMemfdSizeSeals = F_SEAL_SHRINK | F_SEAL_GROW;
+
+// 回傳已 ftruncate + 封住大小的 fd；失敗回 -1（errno 保留）
+static inline int wrap_memfd_create(const char* name, size_t size) {
+    int fd = (int)syscall(__NR_memfd_create, name ? name : "wrap-memfd", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) return -1;
+    if (ftruncate(fd, (off_t)size) != 0 || fcntl(fd, F_ADD_SEALS, kMemfdSizeSeals) != 0) {
+        const int err = errno;
+        ::close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+} // namespace android
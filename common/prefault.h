@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "wrap_util.h"
+
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE 14
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+#ifndef RUSAGE_THREAD
+#define RUSAGE_THREAD 1
+#endif
+
+namespace android {
+
+// 大 allocation 預先 fault-in：960fps 串流第一次寫進新 buffer 時不用再吃幾千次 minor fault
+// - 門檻：persist.vendor.sony.camera.wrap_prefault_min_kb（預設 8192 KiB；0 或負值 = 關）
+// - 先標 MADV_HUGEPAGE（kernel / shmem 設定允許時才有 THP），再 MADV_POPULATE_WRITE，
+//   舊 kernel（< 5.14）不支援就每頁寫一次
+// - 每次花的 minor fault 數跟時間記進 PrefaultStats 與 trace（kEvPrefault）
+// 只能用在剛從 kernel 拿到、內容全 0 的 mapping（fallback 會寫 0）
+struct PrefaultStats {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> minflt{0};
+    std::atomic<uint64_t> ns{0};
+};
+
+static inline PrefaultStats& prefault_stats() {
+    static PrefaultStats* s = new PrefaultStats();
+    return *s;
+}
+
+// 0 = 關
+static inline size_t prefault_min_bytes() {
+    static const long kb = wrap_prop_long("persist.vendor.sony.camera.wrap_prefault_min_kb", 8192);
+    return kb > 0 ? (size_t)kb * 1024 : 0;
+}
+
+static inline long thread_minflt() {
+    struct rusage ru;
+    if (getrusage(RUSAGE_THREAD, &ru) != 0) return 0;
+    return ru.ru_minflt;
+}
+
+// 回傳這次花的 minor fault 數；ns_out 可為 nullptr
+static inline uint64_t wrap_prefault(void* base, size_t len, int64_t* ns_out) {
+    const int64_t t0 = wrap_now_ns();
+    const long f0 = thread_minflt();
+
+    if (len >= 2UL * 1024UL * 1024UL) madvise(base, len, MADV_HUGEPAGE); // 不支援就算了
+    if (madvise(base, len, MADV_POPULATE_WRITE) != 0) {
+        const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        volatile uint8_t* p = static_cast<volatile uint8_t*>(base);
+        for (size_t off = 0; off < len; off += page) p[off] = 0;
+    }
+
+    const long f1 = thread_minflt();
+    const int64_t ns = wrap_now_ns() - t0;
+    const uint64_t faults = f1 > f0 ? (uint64_t)(f1 - f0) : 0;
+
+    PrefaultStats& s = prefault_stats();
+    s.count.fetch_add(1, std::memory_order_relaxed);
+    s.bytes.fetch_add(len, std::memory_order_relaxed);
+    s.minflt.fetch_add(faults, std::memory_order_relaxed);
+    s.ns.fetch_add((uint64_t)ns, std::memory_order_relaxed);
+    if (ns_out) *ns_out = ns;
+    return faults;
+}
+
+// out 依序填 count / bytes / minflt / ns，回傳填了幾個
+static inline size_t prefault_stats_read(uint64_t* out, size_t n) {
+    PrefaultStats& s = prefault_stats();
+    const uint64_t v[4] = {s.count.load(std::memory_order_relaxed), s.bytes.load(std::memory_order_relaxed),
+                           s.minflt.load(std::memory_order_relaxed), s.ns.load(std::memory_order_relaxed)};
+    size_t i = 0;
+    for (; out && i < n && i < 4; i++) out[i] = v[i];
+    return i;
+}
+
+} // namespace android
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <binder/IMemory.h>
+#include <binder/MemoryBase.h>
+#include <binder/MemoryHeapBase.h>
+#include <utils/StrongPointer.h>
+
+#include "alloc_fix.h"
+#include "wrap_trace.h"
+#include "wrap_util.h"
+
+namespace android {
+
+// 超過 allocMemory_common kMax（64 MiB）的大 buffer（例如 192 張 1080p 的 super-slow burst）
+// 改用 scatter list：拆成多個不超過 chunk 大小的 heap，不需要一整塊連續 mapping
+// 對外的入口是 client wrapper 的 android::Cacao::allocScatter
+// 預算只算這個 process 自己的，超過就回 -ENOMEM（不會默默失敗）：
+// - persist.vendor.sony.camera.wrap_scatter_process_mb（預設 1024）
+// 跨 process 的總量不在這裡管：任何 process 都能寫的共用檔案擋不住亂寫的 process，pid 也會被重用；
+// 對端 service 收到的 allocation 由 service 那邊的 ClientQuota（client_quota.h）依 calling pid 記帳。
+class ScatterBudget {
+public:
+    static ScatterBudget& get() {
+        static ScatterBudget* b = new ScatterBudget();
+        return *b;
+    }
+
+    bool reserve(size_t bytes) {
+        std::lock_guard<std::mutex> _l(mLock);
+        if (bytes > mProcessLimit || mUsed > mProcessLimit - bytes) return false;
+        mUsed += bytes;
+        return true;
+    }
+
+    void release(size_t bytes) {
+        std::lock_guard<std::mutex> _l(mLock);
+        mUsed = bytes > mUsed ? 0 : mUsed - bytes;
+    }
+
+    size_t used() {
+        std::lock_guard<std::mutex> _l(mLock);
+        return mUsed;
+    }
+
+    size_t limit() const { return mProcessLimit; }
+
+private:
+    ScatterBudget() {
+        const long mb = wrap_prop_long("persist.vendor.sony.camera.wrap_scatter_process_mb", 1024);
+        // ILP32 上 size_t 放不下的設定值夾到最大
+        mProcessLimit = mb <= 0 ? 0 : ((uint64_t)mb << 20) > (uint64_t)SIZE_MAX ? SIZE_MAX : (size_t)mb << 20;
+    }
+
+    std::mutex mLock;
+    size_t mUsed = 0;
+    size_t mProcessLimit = 0;
+};
+
+// 一個 chunk；dtor 時把 bytes 還給 ScatterBudget（對端還持有 heap 也算已釋放：
+// 我們這邊的 mapping 已經不用了）
+// heap 每次直接建、剛好 size bytes，不經 HeapPool：chunk 通常比最大 size class 大，還回去也只會被丟掉，
+// 而且跟 burst reservation 同 size 時會拿走 reserved heap 又不還；
+// AllocStats 跟 ScatterBudget 記的都是 size（heap 沒有被 size class 放大）
+class ScatterMemory : public MemoryBase {
+public:
+    ScatterMemory(const sp<MemoryHeapBase>& heap, size_t size) : MemoryBase(heap, 0, size), mSize(size) {
+        ticket.arm("allocScatter_common", size);
+    }
+    ~ScatterMemory() override { ScatterBudget::get().release(mSize); }
+
+    AllocTicket ticket;
+
+private:
+    const size_t mSize;
+};
+
+struct ScatterList {
+    std::vector<sp<IMemory>> chunks;
+    size_t total = 0;
+
+    void clear() {
+        chunks.clear();
+        total = 0;
+    }
+};
+
+static constexpr size_t kScatterChunk = 32UL * 1024UL * 1024UL;
+
+// total 拆成 <= chunkSize 的 heap（chunkSize 會被夾到 [4 KiB, 64 MiB]）
+// flags 只看 kAllocMemfd；回傳 0，或 -ENOMEM（預算 / 建 heap 失敗）、-EINVAL
+// 失敗時 out 為空，已拿的 chunk 都已放回
+static inline int allocScatter_common(uint64_t total, ScatterList& out, unsigned flags = 0,
+                                      size_t chunkSize = kScatterChunk, void* ra = nullptr) {
+    out.clear();
+    int hi_ff = 0;
+    const uint64_t raw = total;
+    total = fix_size_u64(total, &hi_ff);
+    const uint16_t tflags = hi_ff ? wraptrace::kFlagHiFF : 0;
+    // out.total 是 size_t：ILP32 上放不下的就直接拒絕（反正也超過預算）
+    if (total == 0 || total > (uint64_t)SIZE_MAX) {
+        wrap_trace(wraptrace::kEvScatter, tflags, ra, raw, 0, -EINVAL);
+        return -EINVAL;
+    }
+    if (chunkSize < 4096) chunkSize = 4096;
+    if (chunkSize > 64UL * 1024UL * 1024UL) chunkSize = 64UL * 1024UL * 1024UL;
+
+    const size_t prefaultMin = prefault_min_bytes();
+    uint64_t left = total;
+    while (left > 0) {
+        const size_t n = left > chunkSize ? chunkSize : (size_t)left;
+        if (!ScatterBudget::get().reserve(n)) break;
+        sp<MemoryHeapBase> heap;
+        if (flags & kAllocMemfd)
+            heap = make_memfd_heap(n, "wrap-scatter");
+        else
+            heap = new (std::nothrow) MemoryHeapBase(n, 0, nullptr);
+        if (heap != nullptr && (heap->getHeapID() < 0 || heap->getBase() == MAP_FAILED)) heap.clear();
+        sp<IMemory> mem;
+        if (heap != nullptr) mem = new (std::nothrow) ScatterMemory(heap, n);
+        if (mem == nullptr) {
+            ScatterBudget::get().release(n);
+            break;
+        }
+        // 新的 mapping 是全 0；夠大就跟 allocMemory_common 一樣 prefault
+        if (prefaultMin && n >= prefaultMin) wrap_prefault(heap->getBase(), n, nullptr);
+        out.chunks.push_back(mem);
+        left -= n;
+    }
+
+    if (left > 0) {
+        wrap_trace(wraptrace::kEvScatter, tflags, ra, raw, out.chunks.size(), -ENOMEM);
+        out.clear();
+        return -ENOMEM;
+    }
+    out.total = (size_t)total;
+    wrap_trace(wraptrace::kEvScatter, tflags, ra, raw, out.chunks.size(), 0);
+    return 0;
+}
+
+} // namespace android
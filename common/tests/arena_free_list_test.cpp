@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+
+#include "arena_free_list.h"
+
+namespace android {
+namespace {
+
+TEST(ArenaFreeList, CarvesFirstFit) {
+    ArenaFreeList f(1024);
+    size_t off = 0, dirty = 0;
+    ASSERT_TRUE(f.carve(64, &off, &dirty));
+    EXPECT_EQ(0u, off);
+    ASSERT_TRUE(f.carve(128, &off, &dirty));
+    EXPECT_EQ(64u, off);
+    EXPECT_EQ(1024u - 192u, f.freeBytes());
+    EXPECT_FALSE(f.carve(1024, &off, &dirty));
+    EXPECT_FALSE(f.carve(0, &off, &dirty));
+}
+
+TEST(ArenaFreeList, CoalescesWithBothNeighbours) {
+    ArenaFreeList f(4 * 64);
+    size_t off[4], dirty = 0;
+    for (size_t& o : off) ASSERT_TRUE(f.carve(64, &o, &dirty));
+    ASSERT_TRUE(f.blocks().empty());
+
+    f.release(off[0], 64);
+    f.release(off[2], 64);
+    EXPECT_EQ(2u, f.blocks().size());
+
+    // 夾在兩個空塊中間：三塊併成一塊
+    f.release(off[1], 64);
+    ASSERT_EQ(1u, f.blocks().size());
+    EXPECT_EQ(0u, f.blocks().begin()->first);
+    EXPECT_EQ(3u * 64u, f.blocks().begin()->second);
+
+    f.release(off[3], 64);
+    ASSERT_EQ(1u, f.blocks().size());
+    EXPECT_EQ(4u * 64u, f.blocks().begin()->second);
+}
+
+TEST(ArenaFreeList, CoalescedBlockServesLargerCarve) {
+    ArenaFreeList f(3 * 64);
+    size_t a, b, c, dirty = 0;
+    ASSERT_TRUE(f.carve(64, &a, &dirty));
+    ASSERT_TRUE(f.carve(64, &b, &dirty));
+    ASSERT_TRUE(f.carve(64, &c, &dirty));
+    f.release(b, 64);
+    f.release(a, 64);
+
+    size_t off = 0;
+    ASSERT_TRUE(f.carve(128, &off, &dirty));
+    EXPECT_EQ(0u, off);
+}
+
+TEST(ArenaFreeList, DirtyStopsAtHighWater) {
+    ArenaFreeList f(1024);
+    size_t a, b, dirty = 0;
+    ASSERT_TRUE(f.carve(128, &a, &dirty));
+    EXPECT_EQ(0u, dirty);
+    ASSERT_TRUE(f.carve(64, &b, &dirty));
+    EXPECT_EQ(192u, f.highWater());
+    f.release(a, 128);
+
+    // 重用 [0, 256)：只有 high-water 以下（192）可能髒
+    size_t off = 0;
+    ASSERT_TRUE(f.carve(64, &off, &dirty));
+    EXPECT_EQ(0u, off);
+    EXPECT_EQ(64u, dirty);
+    ASSERT_TRUE(f.carve(64, &off, &dirty));
+    EXPECT_EQ(64u, off);
+    EXPECT_EQ(64u, dirty);
+    ASSERT_TRUE(f.carve(128, &off, &dirty));
+    EXPECT_EQ(192u, off);
+    EXPECT_EQ(0u, dirty);
+    EXPECT_EQ(320u, f.highWater());
+}
+
+} // namespace
+} // namespace android
@@ -0,0 +1,119 @@
+#include <string.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "caps_cache.h"
+
+namespace android {
+namespace {
+
+constexpr size_t kBlob = CapsCache::kBlobSize;
+
+// prepare 寫出的 blob；service 回來的 reply 跟 payload 都跟它不一樣
+struct Exchange {
+    uint8_t prepared[kBlob];
+    uint8_t reply[kBlob];
+    std::vector<uint8_t> payload;
+
+    Exchange() : payload(256) {
+        memset(prepared, 0x11, sizeof(prepared));
+        memcpy(reply, prepared, sizeof(reply));
+        reply[0] = 0xa5;       // service 就地改過
+        reply[kBlob - 1] = 0x5a;
+        for (size_t i = 0; i < payload.size(); i++) payload[i] = (uint8_t)(i * 7 + 3);
+    }
+};
+
+const void* const kSvc = reinterpret_cast<const void*>(0x1000);
+
+TEST(CapsCache, HitReturnsServiceReplyAndPayload) {
+    CapsCache c;
+    Exchange ex;
+    c.store(0, 0x200, kSvc, ex.prepared, ex.reply, ex.payload.data(), ex.payload.size());
+
+    CapsCache::Result r;
+    ASSERT_TRUE(c.lookup(0, 0x200, kSvc, ex.prepared, &r));
+    EXPECT_EQ(0, memcmp(r.reply, ex.reply, kBlob));
+    EXPECT_NE(0, memcmp(r.reply, ex.prepared, kBlob)); // 不是 prepare 出來的那份
+    EXPECT_EQ(ex.payload, r.payload);
+}
+
+TEST(CapsCache, StoresCopyOfPayload) {
+    CapsCache c;
+    Exchange ex;
+    const std::vector<uint8_t> expect = ex.payload;
+    c.store(0, 0x200, kSvc, ex.prepared, ex.reply, ex.payload.data(), ex.payload.size());
+    // exchange 的 mem 下一次呼叫會被蓋掉
+    memset(ex.payload.data(), 0, ex.payload.size());
+
+    CapsCache::Result r;
+    ASSERT_TRUE(c.lookup(0, 0x200, kSvc, ex.prepared, &r));
+    EXPECT_EQ(expect, r.payload);
+}
+
+TEST(CapsCache, MissOnDifferentKeyOrPrepared) {
+    CapsCache c;
+    Exchange ex;
+    c.store(0, 0x200, kSvc, ex.prepared, ex.reply, ex.payload.data(), ex.payload.size());
+
+    CapsCache::Result r;
+    EXPECT_FALSE(c.lookup(1, 0x200, kSvc, ex.prepared, &r));
+    EXPECT_FALSE(c.lookup(0, 0x400, kSvc, ex.prepared, &r));
+    uint8_t other[kBlob];
+    memcpy(other, ex.prepared, kBlob);
+    other[100] ^= 1;
+    EXPECT_FALSE(c.lookup(0, 0x200, kSvc, other, &r));
+}
+
+TEST(CapsCache, ServiceChangeClearsEntries) {
+    CapsCache c;
+    Exchange ex;
+    c.store(0, 0x200, kSvc, ex.prepared, ex.reply, ex.payload.data(), ex.payload.size());
+
+    CapsCache::Result r;
+    const void* other = reinterpret_cast<const void*>(0x2000);
+    EXPECT_FALSE(c.lookup(0, 0x200, other, ex.prepared, &r));
+    EXPECT_FALSE(c.lookup(0, 0x200, kSvc, ex.prepared, &r)); // 換回來也不會復活
+}
+
+TEST(CapsCache, InvalidateKeepsNothing) {
+    CapsCache c;
+    Exchange ex;
+    c.store(0, 0x200, kSvc, ex.prepared, ex.reply, ex.payload.data(), ex.payload.size());
+    c.invalidate();
+
+    CapsCache::Result r;
+    EXPECT_FALSE(c.lookup(0, 0x200, kSvc, ex.prepared, &r));
+}
+
+TEST(CapsCache, LastGoodSurvivesInvalidate) {
+    CapsCache c;
+    Exchange ex;
+    c.store(0, 0x200, kSvc, ex.prepared, ex.reply, ex.payload.data(), ex.payload.size());
+    c.invalidate();
+    CapsCache::Result r;
+    EXPECT_FALSE(c.lookup(0, 0x200, reinterpret_cast<const void*>(0x2000), ex.prepared, &r));
+
+    // 退回用的是完整的 reply + payload，跟這次 prepare 出來的內容無關
+    EXPECT_TRUE(c.hasLastGood(0, 0x200));
+    EXPECT_FALSE(c.hasLastGood(0, 0x400));
+    ASSERT_TRUE(c.lookupLastGood(0, 0x200, &r));
+    EXPECT_EQ(0, memcmp(r.reply, ex.reply, kBlob));
+    EXPECT_EQ(ex.payload, r.payload);
+}
+
+TEST(CapsCache, OversizedPayloadNotCached) {
+    CapsCache c;
+    Exchange ex;
+    std::vector<uint8_t> big(CapsCache::kMaxPayload + 1, 0x33);
+    c.store(0, 0x200, kSvc, ex.prepared, ex.reply, big.data(), big.size());
+
+    CapsCache::Result r;
+    EXPECT_FALSE(c.lookup(0, 0x200, kSvc, ex.prepared, &r));
+    EXPECT_FALSE(c.hasLastGood(0, 0x200));
+}
+
+} // namespace
+} // namespace android
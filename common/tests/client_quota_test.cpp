@@ -0,0 +1,76 @@
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "client_quota.h"
+
+namespace android {
+namespace {
+
+constexpr size_t kMiB = 1024 * 1024;
+
+TEST(ClientQuota, DisabledAdmitsEverything) {
+    ClientQuota q(0, 0, 0);
+    EXPECT_FALSE(q.enabled());
+    EXPECT_TRUE(q.admit(1, 512 * kMiB));
+    EXPECT_EQ(512 * kMiB, q.bytesOf(1));
+    q.release(1, 512 * kMiB);
+    EXPECT_EQ(0u, q.clients());
+}
+
+TEST(ClientQuota, AccountsPerClient) {
+    ClientQuota q(4, 0, 0);
+    ASSERT_TRUE(q.admit(1, kMiB));
+    ASSERT_TRUE(q.admit(1, 2 * kMiB));
+    ASSERT_TRUE(q.admit(2, kMiB));
+    EXPECT_EQ(3 * kMiB, q.bytesOf(1));
+    EXPECT_EQ(kMiB, q.bytesOf(2));
+    EXPECT_EQ(2u, q.clients());
+
+    q.release(1, kMiB);
+    EXPECT_EQ(2 * kMiB, q.bytesOf(1));
+}
+
+TEST(ClientQuota, RejectsOverClientLimit) {
+    ClientQuota q(4, 0, 0);
+    EXPECT_FALSE(q.admit(1, 5 * kMiB)); // 單筆就超過
+    ASSERT_TRUE(q.admit(1, 3 * kMiB));
+    EXPECT_FALSE(q.admit(1, 2 * kMiB));
+    EXPECT_TRUE(q.admit(2, 2 * kMiB)); // 別的 client 不受影響
+    EXPECT_EQ(3 * kMiB, q.bytesOf(1));
+}
+
+TEST(ClientQuota, RejectsOverServiceLimit) {
+    ClientQuota q(0, 4, 0);
+    ASSERT_TRUE(q.admit(1, 3 * kMiB));
+    EXPECT_FALSE(q.admit(2, 2 * kMiB));
+    q.release(1, 3 * kMiB);
+    EXPECT_TRUE(q.admit(2, 2 * kMiB));
+}
+
+TEST(ClientQuota, ReleaseToZeroDropsClient) {
+    ClientQuota q(4, 0, 0);
+    ASSERT_TRUE(q.admit(7, kMiB));
+    EXPECT_EQ(1u, q.clients());
+    q.release(7, kMiB);
+    EXPECT_EQ(0u, q.clients());
+    EXPECT_EQ(0u, q.bytesOf(7));
+    q.release(7, kMiB); // 多還的不會變負的
+    EXPECT_EQ(0u, q.clients());
+    EXPECT_TRUE(q.admit(7, 4 * kMiB));
+}
+
+TEST(ClientQuota, WaitsForRelease) {
+    ClientQuota q(4, 0, 5000);
+    ASSERT_TRUE(q.admit(1, 4 * kMiB));
+    std::thread t([&q]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        q.release(1, 2 * kMiB);
+    });
+    EXPECT_TRUE(q.admit(1, 2 * kMiB));
+    t.join();
+    EXPECT_EQ(4 * kMiB, q.bytesOf(1));
+}
+
+} // namespace
+} // namespace android
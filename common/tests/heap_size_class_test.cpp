@@ -0,0 +1,36 @@
+#include <gtest/gtest.h>
+
+#include "heap_size_class.h"
+
+namespace android {
+namespace {
+
+TEST(HeapSizeClass, RoundsUpToPowerOfTwo) {
+    EXPECT_EQ(0, HeapSizeClass::of(0));
+    EXPECT_EQ(0, HeapSizeClass::of(1));
+    EXPECT_EQ(0, HeapSizeClass::of(4096));
+    EXPECT_EQ(1, HeapSizeClass::of(4097));
+    EXPECT_EQ(1, HeapSizeClass::of(8192));
+    EXPECT_EQ(8, HeapSizeClass::of(1024 * 1024));
+}
+
+TEST(HeapSizeClass, LargestClassIs8MiB) {
+    const int last = (int)HeapSizeClass::kCount - 1;
+    EXPECT_EQ(last, HeapSizeClass::of(8u * 1024u * 1024u));
+    EXPECT_EQ(8u * 1024u * 1024u, HeapSizeClass::size(last));
+    EXPECT_EQ(-1, HeapSizeClass::of(8u * 1024u * 1024u + 1));
+}
+
+TEST(HeapSizeClass, SizeFitsAndIsTight) {
+    for (size_t s = 1; s <= 8u * 1024u * 1024u; s = s * 3 + 1) {
+        const int cls = HeapSizeClass::of(s);
+        ASSERT_GE(cls, 0) << s;
+        EXPECT_GE(HeapSizeClass::size(cls), s) << s;
+        if (cls > 0) {
+            EXPECT_LT(HeapSizeClass::size(cls - 1), s) << s;
+        }
+    }
+}
+
+} // namespace
+} // namespace android
@@ -0,0 +1,62 @@
+#include <stdint.h>
+
+#include <gtest/gtest.h>
+
+#include "latency_hist.h"
+
+namespace android {
+namespace {
+
+TEST(LatencyHist, SmallValuesGetOwnBucket) {
+    for (uint64_t v = 0; v < LatencyHist::kSub; v++) {
+        EXPECT_EQ(v, LatencyHist::bucketOf(v));
+        EXPECT_EQ(v, LatencyHist::bucketHigh((unsigned)v));
+    }
+}
+
+TEST(LatencyHist, BucketContainsValue) {
+    uint64_t prevHigh = 0;
+    for (unsigned i = 1; i < LatencyHist::kBuckets - 1; i++) {
+        const uint64_t high = LatencyHist::bucketHigh(i);
+        ASSERT_GT(high, prevHigh) << i;
+        EXPECT_EQ(i, LatencyHist::bucketOf(high)) << i;
+        EXPECT_EQ(i, LatencyHist::bucketOf(prevHigh + 1)) << i;
+        prevHigh = high;
+    }
+}
+
+TEST(LatencyHist, RelativeErrorBelowOneSixteenth) {
+    for (uint64_t v = LatencyHist::kSub; v < (1ULL << 39); v = v * 5 / 4 + 7) {
+        const uint64_t high = LatencyHist::bucketHigh(LatencyHist::bucketOf(v));
+        ASSERT_GE(high, v);
+        EXPECT_LT((high - v) * LatencyHist::kSub, v) << v;
+    }
+}
+
+TEST(LatencyHist, HugeValuesClampToLastBucket) {
+    EXPECT_EQ(LatencyHist::kBuckets - 1, LatencyHist::bucketOf(1ULL << LatencyHist::kMaxBits));
+    EXPECT_EQ(LatencyHist::kBuckets - 1, LatencyHist::bucketOf(UINT64_MAX));
+}
+
+TEST(LatencyHist, Percentiles) {
+    LatencyHist h;
+    for (int i = 1; i <= 1000; i++) h.add(i * 1000);
+    h.add(-5); // 負的當 0
+    EXPECT_EQ(1001u, h.count());
+
+    uint64_t p[4];
+    h.percentiles(p);
+    EXPECT_NEAR(500000.0, (double)p[0], 500000.0 / 16);
+    EXPECT_NEAR(900000.0, (double)p[1], 900000.0 / 16);
+    EXPECT_NEAR(990000.0, (double)p[2], 990000.0 / 16);
+    EXPECT_LE(p[0], p[1]);
+    EXPECT_LE(p[2], p[3]);
+
+    h.reset();
+    EXPECT_EQ(0u, h.count());
+    h.percentiles(p);
+    EXPECT_EQ(0u, p[3]);
+}
+
+} // namespace
+} // namespace android
@@ -0,0 +1,45 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "memfd_util.h"
+
+namespace android {
+namespace {
+
+TEST(MemfdUtil, CreatesSizedFd) {
+    const int fd = wrap_memfd_create("memfd-test", 3 * 4096);
+    ASSERT_GE(fd, 0);
+    struct stat st;
+    ASSERT_EQ(0, fstat(fd, &st));
+    EXPECT_EQ(3 * 4096, st.st_size);
+    EXPECT_NE(0, fcntl(fd, F_GETFD) & FD_CLOEXEC);
+    close(fd);
+}
+
+TEST(MemfdUtil, SizeIsSealed) {
+    const int fd = wrap_memfd_create("memfd-test", 4096);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(kMemfdSizeSeals, fcntl(fd, F_GET_SEALS) & kMemfdSizeSeals);
+    EXPECT_NE(0, ftruncate(fd, 8192));
+    EXPECT_NE(0, ftruncate(fd, 0));
+    // 沒封 F_SEAL_SEAL / F_SEAL_WRITE：還能寫、還能再加 seal
+    void* p = mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ASSERT_NE(MAP_FAILED, p);
+    static_cast<char*>(p)[0] = 1;
+    munmap(p, 4096);
+    EXPECT_EQ(0, fcntl(fd, F_ADD_SEALS, F_SEAL_SEAL));
+    close(fd);
+}
+
+TEST(MemfdUtil, NullNameUsesDefault) {
+    const int fd = wrap_memfd_create(nullptr, 4096);
+    ASSERT_GE(fd, 0);
+    close(fd);
+}
+
+} // namespace
+} // namespace android
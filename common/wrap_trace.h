@@ -0,0 +1,162 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <new>
+
+#include <log/log.h>
+
+#include "wrap_trace_format.h"
+#include "wrap_util.h"
+
+namespace android {
+
+// per-thread lock-free binary trace ring，取代 hot path 上的 ALOGE
+// - 每條 thread 第一次記錄時認領一個 ring（thread 結束會還回去給下一條 thread 重用）
+// - 寫入端只有擁有者 thread，用 slot seq 當 seqlock，dump 端可以同時讀
+// - persist.vendor.sony.camera.wrap_trace_log=1 時另外照舊打 ALOGE（debug 用）
+// - dump 用各 wrapper export 的 <lib>_wrapper_trace_dump(fd)，
+//   輸出用 tools/wrap_trace_decode 在 host 端解
+class WrapTrace {
+public:
+    static constexpr uint32_t kRingSize = 256; // 必須是 2 的冪次
+
+    struct Ring {
+        std::atomic<int> owner{0}; // 0 = 空的
+        std::atomic<uint32_t> head{0};
+        std::atomic<Ring*> next{nullptr};
+        wraptrace::Event slots[kRingSize];
+    };
+
+    static WrapTrace& get() {
+        static WrapTrace* t = new WrapTrace();
+        return *t;
+    }
+
+    static bool logEnabled() {
+        static const bool on = wrap_prop_bool("persist.vendor.sony.camera.wrap_trace_log");
+        return on;
+    }
+
+    void record(uint16_t ev, uint16_t flags, const void* ra, uint64_t raw, uint64_t fixed, int64_t result) {
+        Ring* r = localRing();
+        if (!r) return;
+
+        const uint32_t idx = r->head.load(std::memory_order_relaxed);
+        wraptrace::Event& e = r->slots[idx & (kRingSize - 1)];
+        __atomic_store_n(&e.seq, 0u, __ATOMIC_RELAXED);
+        std::atomic_thread_fence(std::memory_order_release);
+        e.event = ev;
+        e.flags = flags;
+        e.pid = mPid;
+        e.tid = r->owner.load(std::memory_order_relaxed);
+        e.ts_ns = wrap_now_ns();
+        e.ra = (uint64_t)(uintptr_t)ra;
+        e.raw = raw;
+        e.fixed = fixed;
+        e.result = result;
+        __atomic_store_n(&e.seq, idx + 1, __ATOMIC_RELEASE);
+        r->head.store(idx + 1, std::memory_order_release);
+    }
+
+    // 把所有 ring 目前的內容寫到 fd；回傳寫出的筆數，失敗回 -1
+    int dump(int fd) {
+        const off_t start = lseek(fd, 0, SEEK_CUR);
+
+        wraptrace::FileHeader hdr;
+        hdr.magic = wraptrace::kMagic;
+        hdr.version = wraptrace::kVersion;
+        hdr.event_size = sizeof(wraptrace::Event);
+        hdr.count = 0; // 寫完再補；fd 不能 seek（pipe/socket）時 decoder 讀到 EOF 為止
+        if (!writeAll(fd, &hdr, sizeof(hdr))) return -1;
+
+        uint32_t written = 0;
+        for (Ring* r = mRings.load(std::memory_order_acquire); r; r = r->next.load(std::memory_order_acquire)) {
+            const uint32_t head = r->head.load(std::memory_order_acquire);
+            const uint32_t n = head < kRingSize ? head : kRingSize;
+            for (uint32_t i = head - n; i != head; i++) {
+                const wraptrace::Event& src = r->slots[i & (kRingSize - 1)];
+                const uint32_t s1 = __atomic_load_n(&src.seq, __ATOMIC_ACQUIRE);
+                wraptrace::Event copy;
+                memcpy(&copy, &src, sizeof(copy));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                const uint32_t s2 = __atomic_load_n(&src.seq, __ATOMIC_RELAXED);
+                if (s1 == 0 || s1 != s2 || s1 != i + 1) continue; // 被覆寫或寫到一半
+                copy.seq = s1;
+                if (!writeAll(fd, &copy, sizeof(copy))) return -1;
+                written++;
+            }
+        }
+
+        if (start >= 0) {
+            hdr.count = written;
+            if (pwrite(fd, &hdr, sizeof(hdr), start) != (ssize_t)sizeof(hdr)) return -1;
+        }
+        return (int)written;
+    }
+
+private:
+    // thread 結束時把 ring 還回去
+    struct LocalSlot {
+        Ring* ring = nullptr;
+        ~LocalSlot() {
+            if (ring) ring->owner.store(0, std::memory_order_release);
+        }
+    };
+
+    WrapTrace() : mPid((int)getpid()) {}
+
+    Ring* localRing() {
+        static thread_local LocalSlot slot;
+        if (slot.ring) return slot.ring;
+
+        const int tid = wrap_gettid();
+        for (Ring* r = mRings.load(std::memory_order_acquire); r; r = r->next.load(std::memory_order_acquire)) {
+            int expected = 0;
+            if (r->owner.compare_exchange_strong(expected, tid, std::memory_order_acq_rel)) {
+                slot.ring = r;
+                return r;
+            }
+        }
+
+        Ring* r = new (std::nothrow) Ring();
+        if (!r) return nullptr;
+        r->owner.store(tid, std::memory_order_relaxed);
+        Ring* top = mRings.load(std::memory_order_relaxed);
+        do {
+            r->next.store(top, std::memory_order_relaxed);
+        } while (!mRings.compare_exchange_weak(top, r, std::memory_order_release, std::memory_order_relaxed));
+        slot.ring = r;
+        return r;
+    }
+
+    static bool writeAll(int fd, const void* buf, size_t len) {
+        const uint8_t* p = static_cast<const uint8_t*>(buf);
+        while (len > 0) {
+            ssize_t n = write(fd, p, len);
+            if (n <= 0) return false;
+            p += (size_t)n;
+            len -= (size_t)n;
+        }
+        return true;
+    }
+
+    const int mPid;
+    std::atomic<Ring*> mRings{nullptr};
+};
+
+static inline void wrap_trace(uint16_t ev, uint16_t flags, const void* ra, uint64_t raw, uint64_t fixed,
+                              int64_t result) {
+    WrapTrace::get().record(ev, flags, ra, raw, fixed, result);
+    if (WrapTrace::logEnabled()) {
+        ALOGE("WRAP: trace %s flags=0x%x ra=%p raw=%" PRIu64 "(0x%" PRIx64 ") fixed=%" PRIu64 " result=%" PRId64,
+              wraptrace::event_name(ev), (unsigned)flags, ra, raw, raw, fixed, result);
+    }
+}
+
+} // namespace android
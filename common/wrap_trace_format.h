@@ -0,0 +1,76 @@
+#pragma once
+
+// wrap trace 的 binary 格式（device 端寫、host 端 decoder 讀），不可依賴 Android header
+
+#include <stdint.h>
+
+namespace wraptrace {
+
+static constexpr uint32_t kMagic   = 0x52545257; // "WRTR"
+static constexpr uint32_t kVersion = 1;
+
+// 事件種類；raw / fixed / result 的意義依事件而定
+enum EventId : uint16_t {
+    kEvNone           = 0,
+    kEvAlloc          = 1, // raw=caller 給的 size, fixed=修正後 size, result=0 成功 / -1 失敗
+    kEvAllocReject    = 2, // raw, fixed 同上, result=-1
+    kEvGetCaps        = 3, // raw=caps raw size, result=getCaps 回傳值
+    kEvNativeGetCaps  = 4, // raw=cameraIndex, result=real 回傳值
+    kEvSuperSlowMode  = 5, // raw=(fps<<32)|frameNum 原值, fixed=修正後, result=real 回傳值
+    kEvPrefault       = 6, // raw=heap bytes, fixed=minor fault 數, result=花費 ns
+    kEvScatter        = 7, // raw=caller 給的 total, fixed=chunk 數, result=0 / -errno
+    kEvBurstReserve   = 8, // raw=(frameBytes<<32)|frames, fixed=reserve 到的 bytes, result=0 / -errno（部分）
+    kEvFrameLate      = 9, // raw=跟上一個 queueBuffer 的間隔 ns, fixed=(目標 fps<<32)|估計掉的 frame 數, result=queueBuffer ns
+};
+
+// flags
+enum : uint16_t {
+    kFlagHiFF      = 1u << 0, // raw 有 0xffffffff 高位 sign-extend 污染
+    kFlagClampMin  = 1u << 1, // caps path 被拉到 kCapsMin
+    kFlagFresh     = 1u << 2, // 新建的 heap（非 pool 重用）
+    kFlagPatched   = 1u << 3, // wrapper 改過參數（例如 super-slow fps=0 補 960）
+    kFlagCapsPath  = 1u << 4, // getCaps 的 alloc policy（以前是 who == "Cacao::getCaps"）
+    kFlagArena     = 1u << 5, // 從 HeapArena 切出來的區塊
+    kFlagQuota     = 1u << 6, // 被 ClientQuota 拒絕
+};
+
+// ring 裡的一筆；arm / arm64 同 layout
+struct Event {
+    uint32_t seq;   // 寫入中為 0，寫完為 slot 序號 + 1
+    uint16_t event; // EventId
+    uint16_t flags;
+    int32_t  pid;
+    int32_t  tid;
+    int64_t  ts_ns; // CLOCK_MONOTONIC
+    uint64_t ra;
+    uint64_t raw;
+    uint64_t fixed;
+    int64_t  result;
+};
+static_assert(sizeof(Event) == 56, "wraptrace::Event layout changed");
+
+// dump 檔：FileHeader 後面接 count 筆 Event
+struct FileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t event_size;
+    uint32_t count;
+};
+static_assert(sizeof(FileHeader) == 16, "wraptrace::FileHeader layout changed");
+
+static inline const char* event_name(uint16_t ev) {
+    switch (ev) {
+        case kEvAlloc:         return "alloc";
+        case kEvAllocReject:   return "alloc_reject";
+        case kEvGetCaps:       return "getCaps";
+        case kEvNativeGetCaps: return "nativeGetCaps";
+        case kEvSuperSlowMode: return "nativeChangeToSuperSlowMode";
+        case kEvPrefault:      return "prefault";
+        case kEvScatter:       return "alloc_scatter";
+        case kEvBurstReserve:  return "burst_reserve";
+        case kEvFrameLate:     return "frame_late";
+        default:               return "?";
+    }
+}
+
+} // namespace wraptrace
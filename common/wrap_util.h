@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+#if defined(__BIONIC__)
+#include <sys/system_properties.h>
+#elif !defined(PROP_VALUE_MAX)
+#define PROP_VALUE_MAX 92
+#endif
+
+namespace android {
+
+static constexpr const char* kCameraPkg = "com.sonyericsson.android.camera";
+
+// CLOCK_MONOTONIC 的 ns，給 pool / trace 共用
+static inline int64_t wrap_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + (int64_t)ts.tv_nsec;
+}
+
+static inline int wrap_gettid() {
+#if defined(__BIONIC__)
+    return (int)gettid();
+#else
+    return (int)syscall(SYS_gettid);
+#endif
+}
+
+// 回傳值的長度，沒設回 0；host（test）上沒有 property，一律當沒設
+static inline int wrap_prop_get(const char* name, char v[PROP_VALUE_MAX]) {
+#if defined(__BIONIC__)
+    return __system_property_get(name, v);
+#else
+    (void)name;
+    v[0] = '\0';
+    return 0;
+#endif
+}
+
+// 1/t/T/y/Y 當成開
+static inline bool wrap_prop_bool(const char* name) {
+    char v[PROP_VALUE_MAX] = {0};
+    wrap_prop_get(name, v);
+    return (v[0] == '1') || (v[0] == 't') || (v[0] == 'T') || (v[0] == 'y') || (v[0] == 'Y');
+}
+
+static inline long wrap_prop_long(const char* name, long def) {
+    char v[PROP_VALUE_MAX] = {0};
+    if (wrap_prop_get(name, v) <= 0) return def;
+    char* end = nullptr;
+    long n = strtol(v, &end, 0);
+    return (end && end != v) ? n : def;
+}
+
+static inline std::string get_build_fingerprint() {
+    char buf[PROP_VALUE_MAX] = {0};
+    int n = wrap_prop_get("ro.build.fingerprint", buf);
+    if (n <= 0) return std::string("unknown");
+    return std::string(buf);
+}
+
+// CameraApp 的 data dir：優先 /data/user/0（multi-user），沒有再找舊的 /data/data
+static inline std::string get_camera_data_dir() {
+    std::string d1 = std::string("/data/user/0/") + kCameraPkg;
+    if (access(d1.c_str(), F_OK) == 0) return d1;
+    std::string d2 = std::string("/data/data/") + kCameraPkg;
+    if (access(d2.c_str(), F_OK) == 0) return d2;
+    return std::string();
+}
+
+} // namespace android
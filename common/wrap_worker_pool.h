@@ -0,0 +1,89 @@
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/resource.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <string>
+#include <utility>
+
+#include <log/log.h>
+
+#include "wrap_util.h"
+
+namespace android {
+
+// 小型固定大小 worker pool（給 async getCaps / 背景 prefetch 用）
+// - 第一次 post() 才開 thread
+// - nice 可以把 worker 降優先權（prefetch 不要跟 UI 搶 CPU）
+// - queue 有上限，滿了 post() 回 false，由 caller 自己同步做
+// - 物件本身故意不 delete（detached thread 可能還在跑）
+class WrapWorkerPool {
+public:
+    static constexpr size_t kMaxQueued = 64;
+
+    WrapWorkerPool(const char* name, unsigned threads, int nice)
+        : mName(name), mThreads(threads ? threads : 1), mNice(nice) {}
+
+    WrapWorkerPool(const WrapWorkerPool&) = delete;
+    WrapWorkerPool& operator=(const WrapWorkerPool&) = delete;
+
+    bool post(std::function<void()> fn) {
+        {
+            std::lock_guard<std::mutex> _l(mLock);
+            if (mQueue.size() >= kMaxQueued) return false;
+            if (!mStarted) {
+                mStarted = true;
+                for (unsigned i = 0; i < mThreads; i++) {
+                    pthread_t t;
+                    if (pthread_create(&t, nullptr, threadMain, this) == 0) {
+                        pthread_detach(t);
+                        mRunning++;
+                    }
+                }
+            }
+            if (mRunning == 0) return false;
+            mQueue.push_back(std::move(fn));
+        }
+        mCond.notify_one();
+        return true;
+    }
+
+private:
+    static void* threadMain(void* arg) {
+        WrapWorkerPool* self = static_cast<WrapWorkerPool*>(arg);
+        // thread 名稱上限 15 字元
+        std::string n = self->mName.substr(0, 15);
+        pthread_setname_np(pthread_self(), n.c_str());
+        if (self->mNice != 0) setpriority(PRIO_PROCESS, (id_t)wrap_gettid(), self->mNice);
+
+        while (true) {
+            std::function<void()> fn;
+            {
+                std::unique_lock<std::mutex> _l(self->mLock);
+                self->mCond.wait(_l, [self] { return !self->mQueue.empty(); });
+                fn = std::move(self->mQueue.front());
+                self->mQueue.pop_front();
+            }
+            fn();
+        }
+        return nullptr;
+    }
+
+    const std::string mName;
+    const unsigned mThreads;
+    const int mNice;
+
+    std::mutex mLock;
+    std::condition_variable mCond;
+    std::deque<std::function<void()>> mQueue;
+    bool mStarted = false;
+    unsigned mRunning = 0;
+};
+
+} // namespace android
@@ -3,6 +3,8 @@
 #include <binder/IBinder.h>
 #include <utils/StrongPointer.h>
 
+#include "frame_pacing.h"
+
 using namespace android;
 
 extern "C" __attribute__((visibility("default")))
@@ -10,6 +12,19 @@ const char* libcacao_process_ctrl_gateway_wrapper_build_tag() {
     return "libcacao_process_ctrl_gateway wrapper: Surface 2-arg ctor shim";
 }
 
+// shim 建出來的 Surface 的 frame pacing 統計（persist.vendor.sony.camera.wrap_frame_pacing=1 才有；見 common/frame_pacing.h）
+extern "C" __attribute__((visibility("default")))
+int libcacao_process_ctrl_gateway_wrapper_frame_pacing_dump(int fd) {
+    if (!android::FramePacing::enabled()) return 0;
+    return android::FramePacing::get().dump(fd);
+}
+
+// trace ring dump（目前只有 frame_late）：輸出格式見 common/wrap_trace_format.h，用 wrap_trace_decode 解
+extern "C" __attribute__((visibility("default")))
+int libcacao_process_ctrl_gateway_wrapper_trace_dump(int fd) {
+    return android::WrapTrace::get().dump(fd);
+}
+
 // 3-arg ctor（系統 libgui.so 內有的符號）
 extern "C" void Surface_ctor3_C1(android::Surface* thiz,
                                 const sp<android::IGraphicBufferProducer>& bp,
@@ -23,13 +38,14 @@ extern "C" void Surface_ctor3_C2(android::Surface* thiz,
                                 const sp<android::IBinder>& handle)
     __asm__("_ZN7android7SurfaceC2ERKNS_2spINS_22IGraphicBufferProducerEEEbRKNS1_INS_7IBinderEEE");
 
-// 2-arg ctor（blob 缺的符號）：轉呼叫 3-arg ctor，handle 傳 null
+// 2-arg ctor（blob 缺的符號）：轉呼叫 3-arg ctor，handle 傳 null；opt-in 時順便掛 frame pacing 量測
 extern "C" void
 _ZN7android7SurfaceC1ERKNS_2spINS_22IGraphicBufferProducerEEEb(android::Surface* thiz,
                                                               const sp<android::IGraphicBufferProducer>& bp,
                                                               bool controlledByApp) {
     sp<android::IBinder> nullHandle;
     Surface_ctor3_C1(thiz, bp, controlledByApp, nullHandle);
+    android::FramePacing::maybeInstall(static_cast<ANativeWindow*>(thiz), "gateway");
 }
 
 extern "C" void
@@ -38,4 +54,5 @@ _ZN7android7SurfaceC2ERKNS_2spINS_22IGraphicBufferProducerEEEb(android::Surface*
                                                               bool controlledByApp) {
     sp<android::IBinder> nullHandle;
     Surface_ctor3_C2(thiz, bp, controlledByApp, nullHandle);
+    android::FramePacing::maybeInstall(static_cast<ANativeWindow*>(thiz), "gateway");
 }
@@ -6,16 +6,25 @@
 #include <log/log.h>
 #include <utils/StrongPointer.h> // 提供 sp<> 的定義
 
+#include <ctype.h>
 #include <dirent.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/system_properties.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include "frame_pacing.h"
+#include "latency_hist.h"
+#include "wrap_trace.h"
+
 using namespace android; // 或者在代碼中確保 android:: 前綴正確
 
 extern "C" __attribute__((visibility("default")))
@@ -23,19 +32,30 @@ const char* libimageprocessorjni_wrapper_build_tag() {
     return "libimageprocessorjni wrapper: Surface 2-arg ctor shim + super-slow capability inject";
 }
 
-static constexpr const char* kCameraPkg = "com.sonyericsson.android.camera";
-static constexpr const char* kPrefsFilePrefix = "com.sonyericsson.android.camera.supported_values.";
-static constexpr const char* kPrefsFileSuffix = ".xml";
+// trace ring dump：輸出格式見 common/wrap_trace_format.h，用 wrap_trace_decode 解
+extern "C" __attribute__((visibility("default")))
+int libimageprocessorjni_wrapper_trace_dump(int fd) {
+    return android::WrapTrace::get().dump(fd);
+}
 
-static std::string get_build_fingerprint()
-{
-    char buf[PROP_VALUE_MAX] = {0};
-    int n = __system_property_get("ro.build.fingerprint", buf);
-    if (n <= 0)
-        return std::string("unknown");
-    return std::string(buf);
+// Per-entry-point latency histograms (text, one histogram per line; see common/latency_hist.h).
+extern "C" __attribute__((visibility("default")))
+int libimageprocessorjni_wrapper_latency_dump(int fd) {
+    return android::LatencyStats::get().dump(fd);
+}
+
+// Frame pacing of Surfaces created through the 2-arg ctor shim (only with
+// persist.vendor.sony.camera.wrap_frame_pacing=1; see common/frame_pacing.h).
+extern "C" __attribute__((visibility("default")))
+int libimageprocessorjni_wrapper_frame_pacing_dump(int fd) {
+    if (!android::FramePacing::enabled())
+        return 0;
+    return android::FramePacing::get().dump(fd);
 }
 
+static constexpr const char* kPrefsFilePrefix = "com.sonyericsson.android.camera.supported_values.";
+static constexpr const char* kPrefsFileSuffix = ".xml";
+
 static std::string get_prefs_dir()
 {
     // Prefer /data/user/0 (multi-user aware), fall back to legacy /data/data.
@@ -188,6 +208,8 @@ static bool replace_or_insert_int_key(std::string& xml, const std::string& key,
     return true;
 }
 
+static std::string super_slow_prefs_config();
+
 static void patch_super_slow_keys_best_effort(const std::string& filePath)
 {
     std::string xml;
@@ -196,7 +218,7 @@ static void patch_super_slow_keys_best_effort(const std::string& filePath)
 
     const std::string fp = get_build_fingerprint();
     const std::string superSlowValues = "1;on";
-    const std::string superSlowConfig = "2;1280x720@192/960;1920x1080@192/960";
+    const std::string superSlowConfig = super_slow_prefs_config();
 
     bool changed = false;
     changed |= replace_or_insert_string_key(xml, "android.os.Build.FINGERPRINT", fp);
@@ -286,77 +308,567 @@ jint Java_com_sonymobile_imageprocessor_bypasscamera2_BypassCamera_nativeChangeT
     jint fps,
     jint frameNum);
 
-static Real_nativeGetCapsFn load_real_nativeGetCaps()
+using Real_JNI_OnLoadFn = jint (*)(JavaVM*, void*);
+
+// ---- libimageprocessorjni_real.so bindings ----
+// One dlopen for every forwarded symbol. The handle is opened once (call_once); each slot is resolved on
+// first use or by the pre-bind thread started from JNI_OnLoad, and published with a release store.
+// dlsym is idempotent, so two threads racing on the same slot store the same value.
+enum RealSym : size_t
+{
+    kRealJNI_OnLoad,
+    kRealNativeGetCaps,
+    kRealNativeChangeToSuperSlowMode,
+    kRealSymCount,
+};
+
+static constexpr const char* kRealSymNames[kRealSymCount] = {
+    "JNI_OnLoad",
+    "Java_com_sonymobile_imageprocessor_bypasscamera2_BypassCamera_nativeGetCaps",
+    "Java_com_sonymobile_imageprocessor_bypasscamera2_BypassCamera_nativeChangeToSuperSlowMode",
+};
+
+class RealLibrary
 {
-    static Real_nativeGetCapsFn fn = nullptr;
-    static bool attempted = false;
-    if (attempted)
-        return fn;
-    attempted = true;
+public:
+    static RealLibrary& get()
+    {
+        static RealLibrary* r = new RealLibrary();
+        return *r;
+    }
 
-    void* h = dlopen("libimageprocessorjni_real.so", RTLD_NOW);
-    if (!h)
+    template <typename Fn>
+    Fn fn(RealSym sym)
     {
-        ALOGE("WRAP: dlopen(libimageprocessorjni_real.so) failed: %s", dlerror());
-        return nullptr;
+        return reinterpret_cast<Fn>(resolve(sym));
     }
 
-    void* sym = dlsym(h, "Java_com_sonymobile_imageprocessor_bypasscamera2_BypassCamera_nativeGetCaps");
-    if (!sym)
+    // Resolve every slot now; called off the critical path.
+    void bindAll()
     {
-        ALOGE("WRAP: dlsym(nativeGetCaps) failed: %s", dlerror());
-        return nullptr;
+        for (size_t i = 0; i < kRealSymCount; i++)
+            (void)resolve(static_cast<RealSym>(i));
+    }
+
+private:
+    // Marks a symbol that dlsym could not find, so it is not looked up again.
+    static constexpr uintptr_t kMissing = 1;
+
+    void* handle()
+    {
+        std::call_once(mOpenOnce, [this] {
+            mHandle = dlopen("libimageprocessorjni_real.so", RTLD_NOW);
+            if (!mHandle)
+                ALOGE("WRAP: dlopen(libimageprocessorjni_real.so) failed: %s", dlerror());
+        });
+        return mHandle;
+    }
+
+    void* resolve(RealSym sym)
+    {
+        uintptr_t v = mSlots[sym].load(std::memory_order_acquire);
+        if (v == 0)
+        {
+            void* h = handle();
+            void* p = h ? dlsym(h, kRealSymNames[sym]) : nullptr;
+            // JNI_OnLoad is optional in the real library.
+            if (!p && h && sym != kRealJNI_OnLoad)
+                ALOGE("WRAP: dlsym(%s) failed: %s", kRealSymNames[sym], dlerror());
+            v = p ? reinterpret_cast<uintptr_t>(p) : kMissing;
+            mSlots[sym].store(v, std::memory_order_release);
+        }
+        return v == kMissing ? nullptr : reinterpret_cast<void*>(v);
+    }
+
+    std::once_flag mOpenOnce;
+    void* mHandle = nullptr;
+    std::atomic<uintptr_t> mSlots[kRealSymCount] = {};
+};
+
+static void* real_prebind_thread_main(void*)
+{
+    RealLibrary::get().bindAll();
+    return nullptr;
+}
+
+static void start_real_prebind()
+{
+    pthread_t t;
+    if (pthread_create(&t, nullptr, real_prebind_thread_main, nullptr) == 0)
+        pthread_detach(t);
+    else
+        RealLibrary::get().bindAll();
+}
+
+// ---- Per-camera slow-motion capability model ----
+// Built from what the real nativeGetCaps put into the Capability object, read back from the object after the
+// call returns (see "Reading the slow-motion lists back" below).
+//
+// Super-slow entries reported by the real library are used as-is. Mode switches get their fps and frame count
+// clamped to them, and a record size they do not list is rejected.
+// Without them the entries are derived from the highest HFR rate the library reported: every HFR size at that
+// rate. persist.vendor.sony.camera.wrap_super_slow_fps, when set, overrides that rate. Only when no HFR entry
+// was reported either are 1280x720 and 1920x1080 at that property (default 960) assumed, which is what this
+// wrapper always injected before. A frame budget the library did not report is 200 ms of capture.
+struct SlowMotionEntry
+{
+    jint w;
+    jint h;
+    jint fps;
+    jint frames;
+};
+
+struct SlowMotionCaps
+{
+    std::vector<SlowMotionEntry> hfr;       // addHighFrameRateSupportedInfo; frames unused
+    std::vector<SlowMotionEntry> superSlow; // addSuperSlowSupportedInfo, paired with addSuperSlowFrameNum
+    bool reported = false;                  // superSlow came from the real library
+};
+
+static constexpr jint kSuperSlowDefaultFps = 960;
+static constexpr jint kSuperSlowBudgetMs = 200;
+
+static jint super_slow_frames_for(jint fps)
+{
+    const jint n = (jint)((int64_t)fps * kSuperSlowBudgetMs / 1000);
+    return n > 0 ? n : 1;
+}
+
+static bool has_slow_motion_size(const std::vector<SlowMotionEntry>& v, jint w, jint h)
+{
+    for (const SlowMotionEntry& e : v)
+    {
+        if (e.w == w && e.h == h)
+            return true;
     }
+    return false;
+}
 
-    fn = reinterpret_cast<Real_nativeGetCapsFn>(sym);
-    return fn;
+// frameNums[i] belongs to superSlow[i], as in the injected caps.
+static void complete_slow_motion_caps(SlowMotionCaps& m, const std::vector<jint>& frameNums)
+{
+    m.reported = !m.superSlow.empty();
+    if (!m.reported)
+    {
+        static const jint overrideFps = []() {
+            const long v = wrap_prop_long("persist.vendor.sony.camera.wrap_super_slow_fps", 0);
+            return (jint)(v > 0 && v <= 10000 ? v : 0);
+        }();
+
+        jint topFps = 0;
+        for (const SlowMotionEntry& e : m.hfr)
+        {
+            if (e.w > 0 && e.h > 0 && e.fps > topFps)
+                topFps = e.fps;
+        }
+        if (topFps > 0)
+        {
+            const jint fps = overrideFps > 0 ? overrideFps : topFps;
+            for (const SlowMotionEntry& e : m.hfr)
+            {
+                if (e.fps == topFps && e.w > 0 && e.h > 0 && !has_slow_motion_size(m.superSlow, e.w, e.h))
+                    m.superSlow.push_back({e.w, e.h, fps, 0});
+            }
+        }
+        else
+        {
+            const jint fps = overrideFps > 0 ? overrideFps : kSuperSlowDefaultFps;
+            m.superSlow.push_back({1280, 720, fps, 0});
+            m.superSlow.push_back({1920, 1080, fps, 0});
+        }
+    }
+    for (size_t i = 0; i < m.superSlow.size(); i++)
+    {
+        SlowMotionEntry& e = m.superSlow[i];
+        const jint reportedFrames = (m.reported && i < frameNums.size()) ? frameNums[i] : 0;
+        e.frames = reportedFrames > 0 ? reportedFrames : super_slow_frames_for(e.fps);
+    }
 }
 
-static Real_nativeChangeToSuperSlowModeFn load_real_nativeChangeToSuperSlowMode()
+class SlowMotionModel
 {
-    static Real_nativeChangeToSuperSlowModeFn fn = nullptr;
-    static bool attempted = false;
-    if (attempted)
-        return fn;
-    attempted = true;
+public:
+    static SlowMotionModel& get()
+    {
+        static SlowMotionModel* m = new SlowMotionModel();
+        return *m;
+    }
 
-    void* h = dlopen("libimageprocessorjni_real.so", RTLD_NOW);
-    if (!h)
+    // The camera whose caps were queried last is the one a following mode switch applies to
+    // (nativeChangeToSuperSlowMode carries no camera index).
+    void update(jint cameraIndex, const SlowMotionCaps& caps)
     {
-        ALOGE("WRAP: dlopen(libimageprocessorjni_real.so) failed: %s", dlerror());
-        return nullptr;
+        std::lock_guard<std::mutex> lock(mLock);
+        for (auto& kv : mCameras)
+        {
+            if (kv.first == cameraIndex)
+            {
+                kv.second = caps;
+                mActive = cameraIndex;
+                mHaveActive = true;
+                return;
+            }
+        }
+        mCameras.emplace_back(cameraIndex, caps);
+        mActive = cameraIndex;
+        mHaveActive = true;
     }
 
-    void* sym = dlsym(h, "Java_com_sonymobile_imageprocessor_bypasscamera2_BypassCamera_nativeChangeToSuperSlowMode");
-    if (!sym)
+    // Falls back to the assumed entries when no caps have been seen yet.
+    SlowMotionCaps active()
     {
-        ALOGE("WRAP: dlsym(nativeChangeToSuperSlowMode) failed: %s", dlerror());
-        return nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            for (const auto& kv : mCameras)
+            {
+                if (mHaveActive && kv.first == mActive)
+                    return kv.second;
+            }
+        }
+        SlowMotionCaps assumed;
+        complete_slow_motion_caps(assumed, std::vector<jint>());
+        return assumed;
+    }
+
+private:
+    std::mutex mLock;
+    std::vector<std::pair<jint, SlowMotionCaps>> mCameras;
+    jint mActive = 0;
+    bool mHaveActive = false;
+};
+
+// Entry for a requested record size: the exact size if supported, otherwise the highest fps, preferring the
+// largest size that still fits the request (or the smallest one if none does).
+static SlowMotionEntry pick_super_slow_entry(const SlowMotionCaps& m, jint w, jint h, bool* exact)
+{
+    *exact = false;
+    const SlowMotionEntry* best = nullptr;
+    for (const SlowMotionEntry& e : m.superSlow)
+    {
+        if (e.w == w && e.h == h && (!best || e.fps > best->fps))
+        {
+            best = &e;
+            *exact = true;
+        }
     }
+    if (*exact)
+        return *best;
 
-    fn = reinterpret_cast<Real_nativeChangeToSuperSlowModeFn>(sym);
-    return fn;
+    for (const SlowMotionEntry& e : m.superSlow)
+    {
+        if (!best)
+        {
+            best = &e;
+            continue;
+        }
+        const int64_t area = (int64_t)e.w * e.h;
+        const int64_t bestArea = (int64_t)best->w * best->h;
+        const bool fits = e.w <= w && e.h <= h;
+        const bool bestFits = best->w <= w && best->h <= h;
+        if (e.fps != best->fps)
+        {
+            if (e.fps > best->fps)
+                best = &e;
+        }
+        else if (fits != bestFits)
+        {
+            if (fits)
+                best = &e;
+        }
+        else if (fits ? area > bestArea : area < bestArea)
+        {
+            best = &e;
+        }
+    }
+    return *best;
 }
 
-using Real_JNI_OnLoadFn = jint (*)(JavaVM*, void*);
+// "count;WxH@frames/fps;..." as used by sony-super-slow-config
+static std::string format_super_slow_config(const SlowMotionCaps& m)
+{
+    std::string s = std::to_string(m.superSlow.size());
+    for (const SlowMotionEntry& e : m.superSlow)
+    {
+        s += ";" + std::to_string(e.w) + "x" + std::to_string(e.h) + "@" + std::to_string(e.frames) + "/" +
+            std::to_string(e.fps);
+    }
+    return s;
+}
+
+static std::string super_slow_prefs_config()
+{
+    return format_super_slow_config(SlowMotionModel::get().active());
+}
+
+// Warm the Cacao service connection and caps buffers in the background (implemented in libcacao_client's wrapper).
+static void kick_caps_prefetch()
+{
+    using PrefetchFn = void (*)();
+    auto fn = reinterpret_cast<PrefetchFn>(dlsym(RTLD_DEFAULT, "libcacao_client_wrapper_prefetch_caps"));
+    if (fn)
+        fn();
+}
+
+// Reserve (or with frames=0, release) the super-slow burst buffers in libcacao_client's wrapper.
+// The frame size is only an estimate (YUV420 at the larger of the record/video sizes); the wrapper
+// waits for a matching CacaoClient::allocMemory and reserves at that exact size, capped by the pool budget.
+static void request_burst_reservation(jint w1, jint h1, jint w2, jint h2, jint frames)
+{
+    using ReserveFn = int (*)(uint32_t, uint32_t);
+    static ReserveFn fn = reinterpret_cast<ReserveFn>(dlsym(RTLD_DEFAULT, "libcacao_client_wrapper_reserve_burst"));
+    if (!fn)
+        return;
+    const uint64_t px1 = (w1 > 0 && h1 > 0) ? (uint64_t)w1 * (uint64_t)h1 : 0;
+    const uint64_t px2 = (w2 > 0 && h2 > 0) ? (uint64_t)w2 * (uint64_t)h2 : 0;
+    const uint64_t frameBytes = (px1 > px2 ? px1 : px2) * 3 / 2;
+    if (frames <= 0 || frameBytes == 0 || frameBytes > UINT32_MAX)
+    {
+        fn(0, 0);
+        return;
+    }
+    fn((uint32_t)frameBytes, (uint32_t)frames);
+}
+
+// ---- BypassCameraParameters$Capability bindings ----
+// Filled once (JNI_OnLoad, or the first nativeGetCaps if FindClass failed there) and published atomically.
+// The global class ref keeps the class, and with it the method IDs, alive for as long as we hold it;
+// it is dropped in JNI_OnUnload together with the class loader.
+// A method that is missing in this CameraApp build stays null and only its own injection is skipped;
+// a list field that is not found stays null and reads back as empty.
+static constexpr const char* kCapabilityClass = "com/sonymobile/imageprocessor/bypasscamera2/BypassCameraParameters$Capability";
+
+struct CapabilityBindings
+{
+    jclass cls = nullptr; // global ref
+    jmethodID addHighFrameRateSupportedInfo = nullptr;
+    jmethodID setSuperSlowMode = nullptr;
+    jmethodID addSuperSlowSupportedInfo = nullptr;
+    jmethodID addSuperSlowFrameNum = nullptr;
+    jfieldID hfrInfo = nullptr;           // list behind addHighFrameRateSupportedInfo
+    jfieldID superSlowInfo = nullptr;     // list behind addSuperSlowSupportedInfo
+    jfieldID superSlowFrameNum = nullptr; // list behind addSuperSlowFrameNum
+};
+
+static std::atomic<CapabilityBindings*> gCapabilityBindings{nullptr};
+static std::mutex gCapabilityBindingsLock;
+
+static jmethodID get_method_or_null(JNIEnv* env, jclass cls, const char* name, const char* sig)
+{
+    jmethodID mid = env->GetMethodID(cls, name, sig);
+    if (!mid && env->ExceptionCheck())
+        env->ExceptionClear();
+    return mid;
+}
 
-static void call_real_JNI_OnLoad_if_present(JavaVM* vm, void* reserved)
+static bool jni_failed(JNIEnv* env)
 {
-    void* h = dlopen("libimageprocessorjni_real.so", RTLD_NOW);
-    if (!h)
+    if (!env->ExceptionCheck())
+        return false;
+    env->ExceptionClear();
+    return true;
+}
+
+// Field names are matched case-insensitively, e.g. mHighFrameRateSupportedInfoList, mSuperSlowFrameNum.
+// A name that fits more than one kind is not used.
+enum class CapsListKind
+{
+    None,
+    Hfr,
+    SuperSlowInfo,
+    SuperSlowFrameNum,
+};
+
+static CapsListKind caps_list_kind(const char* name)
+{
+    std::string n(name ? name : "");
+    for (char& c : n)
+        c = (char)tolower((unsigned char)c);
+    const bool hfr = n.find("highframerate") != std::string::npos;
+    const bool superSlow = n.find("superslow") != std::string::npos;
+    if (hfr)
+        return superSlow ? CapsListKind::None : CapsListKind::Hfr;
+    if (!superSlow)
+        return CapsListKind::None;
+    const bool frameNum = n.find("framenum") != std::string::npos;
+    const bool info = n.find("info") != std::string::npos;
+    if (frameNum == info)
+        return CapsListKind::None;
+    return frameNum ? CapsListKind::SuperSlowFrameNum : CapsListKind::SuperSlowInfo;
+}
+
+// Non-static object fields of cls whose names identify the slow-motion lists (java.lang.reflect, once per class).
+// A kind matched by more than one field stays unbound, so nothing is read back for it rather than a guess.
+static void lookup_capability_fields(JNIEnv* env, jclass cls, CapabilityBindings& out)
+{
+    static constexpr jint kModifierStatic = 0x0008;
+    static const char* const kKindNames[] = {"high-frame-rate info", "super-slow info", "super-slow frame num"};
+    jfieldID* const slots[] = {&out.hfrInfo, &out.superSlowInfo, &out.superSlowFrameNum};
+    int matches[3] = {0, 0, 0};
+
+    jclass classCls = env->FindClass("java/lang/Class");
+    jclass fieldCls = classCls ? env->FindClass("java/lang/reflect/Field") : nullptr;
+    if (!classCls || !fieldCls)
+    {
+        jni_failed(env);
+        if (classCls)
+            env->DeleteLocalRef(classCls);
         return;
-    void* sym = dlsym(h, "JNI_OnLoad");
-    if (!sym)
+    }
+    jmethodID getDeclaredFields = get_method_or_null(env, classCls, "getDeclaredFields", "()[Ljava/lang/reflect/Field;");
+    jmethodID isPrimitive = get_method_or_null(env, classCls, "isPrimitive", "()Z");
+    jmethodID getName = get_method_or_null(env, fieldCls, "getName", "()Ljava/lang/String;");
+    jmethodID getType = get_method_or_null(env, fieldCls, "getType", "()Ljava/lang/Class;");
+    jmethodID getModifiers = get_method_or_null(env, fieldCls, "getModifiers", "()I");
+
+    jobjectArray fields = nullptr;
+    if (getDeclaredFields && isPrimitive && getName && getType && getModifiers)
+    {
+        fields = static_cast<jobjectArray>(env->CallObjectMethod(cls, getDeclaredFields));
+        if (jni_failed(env))
+            fields = nullptr;
+    }
+    const jsize n = fields ? env->GetArrayLength(fields) : 0;
+    for (jsize i = 0; i < n; i++)
+    {
+        jobject f = env->GetObjectArrayElement(fields, i);
+        if (!f)
+        {
+            jni_failed(env);
+            continue;
+        }
+        // Each call is checked before the next one is made; a pending exception makes further calls invalid.
+        const jint mods = env->CallIntMethod(f, getModifiers);
+        bool ok = !jni_failed(env);
+        jobject type = ok ? env->CallObjectMethod(f, getType) : nullptr;
+        ok = ok && !jni_failed(env);
+        jstring name = ok ? static_cast<jstring>(env->CallObjectMethod(f, getName)) : nullptr;
+        ok = ok && !jni_failed(env);
+        bool primitive = false;
+        if (ok && type)
+        {
+            primitive = env->CallBooleanMethod(type, isPrimitive);
+            ok = !jni_failed(env);
+        }
+        if (ok && name && type && !primitive && !(mods & kModifierStatic))
+        {
+            const char* utf = env->GetStringUTFChars(name, nullptr);
+            const CapsListKind kind = utf ? caps_list_kind(utf) : CapsListKind::None;
+            if (utf)
+                env->ReleaseStringUTFChars(name, utf);
+            else
+                jni_failed(env);
+            const int k = kind == CapsListKind::Hfr ? 0
+                : kind == CapsListKind::SuperSlowInfo ? 1
+                : kind == CapsListKind::SuperSlowFrameNum ? 2
+                : -1;
+            if (k >= 0 && matches[k]++ == 0)
+            {
+                *slots[k] = env->FromReflectedField(f);
+                if (jni_failed(env))
+                    *slots[k] = nullptr;
+            }
+        }
+        if (name)
+            env->DeleteLocalRef(name);
+        if (type)
+            env->DeleteLocalRef(type);
+        env->DeleteLocalRef(f);
+    }
+    if (fields)
+        env->DeleteLocalRef(fields);
+    env->DeleteLocalRef(fieldCls);
+    env->DeleteLocalRef(classCls);
+
+    for (int k = 0; k < 3; k++)
+    {
+        if (matches[k] <= 1)
+            continue;
+        ALOGE("WRAP: %d Capability fields look like the %s list, not reading it back", matches[k], kKindNames[k]);
+        *slots[k] = nullptr;
+    }
+}
+
+static void lookup_capability_methods(JNIEnv* env, jclass cls, CapabilityBindings& out)
+{
+    out.addHighFrameRateSupportedInfo = get_method_or_null(env, cls, "addHighFrameRateSupportedInfo", "(III)V");
+    out.setSuperSlowMode = get_method_or_null(env, cls, "setSuperSlowMode", "(I)V");
+    out.addSuperSlowSupportedInfo = get_method_or_null(env, cls, "addSuperSlowSupportedInfo", "(III)V");
+    out.addSuperSlowFrameNum = get_method_or_null(env, cls, "addSuperSlowFrameNum", "(I)V");
+    lookup_capability_fields(env, cls, out);
+}
+
+// cls is a local ref owned by the caller.
+static CapabilityBindings* bind_capability_class(JNIEnv* env, jclass cls)
+{
+    std::lock_guard<std::mutex> lock(gCapabilityBindingsLock);
+    CapabilityBindings* cur = gCapabilityBindings.load(std::memory_order_acquire);
+    if (cur)
+        return cur;
+
+    CapabilityBindings* b = new CapabilityBindings();
+    b->cls = static_cast<jclass>(env->NewGlobalRef(cls));
+    if (!b->cls)
+    {
+        delete b;
+        return nullptr;
+    }
+    lookup_capability_methods(env, b->cls, *b);
+    gCapabilityBindings.store(b, std::memory_order_release);
+    return b;
+}
+
+// Bindings valid for capsObj, or nullptr. An object of a different Capability class (another class loader)
+// gets a one-off lookup into scratch instead of the cached table.
+static const CapabilityBindings* capability_bindings(JNIEnv* env, jobject capsObj, CapabilityBindings& scratch)
+{
+    CapabilityBindings* b = gCapabilityBindings.load(std::memory_order_acquire);
+    if (b && env->IsInstanceOf(capsObj, b->cls))
+        return b;
+
+    jclass cls = env->GetObjectClass(capsObj);
+    if (!cls)
+        return nullptr;
+    const CapabilityBindings* out = nullptr;
+    if (!b)
+        out = bind_capability_class(env, cls);
+    if (!out || !env->IsInstanceOf(capsObj, out->cls))
+    {
+        lookup_capability_methods(env, cls, scratch);
+        out = &scratch;
+    }
+    env->DeleteLocalRef(cls);
+    return out;
+}
+
+static void bind_capability_class_on_load(JNIEnv* env)
+{
+    jclass cls = env->FindClass(kCapabilityClass);
+    if (!cls)
+    {
+        // Retried lazily from the first nativeGetCaps.
+        if (env->ExceptionCheck())
+            env->ExceptionClear();
         return;
-    auto real = reinterpret_cast<Real_JNI_OnLoadFn>(sym);
-    (void)real(vm, reserved);
+    }
+    bind_capability_class(env, cls);
+    env->DeleteLocalRef(cls);
 }
 
 extern "C" __attribute__((visibility("default")))
 jint JNI_OnLoad(JavaVM* vm, void* reserved)
 {
+    static android::LatencyStats::Probe* const latencyProbe = android::LatencyStats::get().probe("JNI_OnLoad");
+    android::LatencyScope latency(latencyProbe);
+
     // Preserve any original init behavior.
-    call_real_JNI_OnLoad_if_present(vm, reserved);
+    if (Real_JNI_OnLoadFn realOnLoad = RealLibrary::get().fn<Real_JNI_OnLoadFn>(kRealJNI_OnLoad))
+        (void)android::latency_real([&] { return realOnLoad(vm, reserved); });
+
+    // The forwarded entry points are bound in the background so the first nativeGetCaps does not pay for dlsym.
+    start_real_prebind();
+
+    // Start before RegisterNatives so the binder round trip overlaps with JNI setup.
+    kick_caps_prefetch();
 
     JNIEnv* env = nullptr;
     if (vm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) != JNI_OK || !env)
@@ -386,6 +898,9 @@ jint JNI_OnLoad(JavaVM* vm, void* reserved)
     const int rc = env->RegisterNatives(cls, methods, 2);
     if (env->ExceptionCheck())
         env->ExceptionClear();
+    env->DeleteLocalRef(cls);
+
+    bind_capability_class_on_load(env);
 
     if (rc != 0)
         ALOGE("WRAP: RegisterNatives(nativeGetCaps/nativeChangeToSuperSlowMode) failed rc=%d", rc);
@@ -398,109 +913,304 @@ jint JNI_OnLoad(JavaVM* vm, void* reserved)
     return JNI_VERSION_1_6;
 }
 
-static void inject_hfr_960(JNIEnv* env, jobject capsObj)
+extern "C" __attribute__((visibility("default")))
+void JNI_OnUnload(JavaVM* vm, void*)
 {
-    if (!env || !capsObj)
+    JNIEnv* env = nullptr;
+    if (vm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) != JNI_OK || !env)
         return;
-
-    jclass cls = env->GetObjectClass(capsObj);
-    if (!cls)
+    std::lock_guard<std::mutex> lock(gCapabilityBindingsLock);
+    CapabilityBindings* b = gCapabilityBindings.exchange(nullptr, std::memory_order_acq_rel);
+    if (!b)
         return;
+    env->DeleteGlobalRef(b->cls);
+    delete b;
+}
 
-    jmethodID mid = env->GetMethodID(cls, "addHighFrameRateSupportedInfo", "(III)V");
-    if (!mid)
+// ---- Reading the slow-motion lists back from a Capability ----
+// The lists are read after the real nativeGetCaps returns and before anything is injected. A list may be a
+// java.util.Collection, an Object[] or a flat int[]; entries may be int[] {w, h, fps}, boxed numbers (frame
+// counts), or objects with width/height/fps int fields or getters. Anything else is skipped.
+class CapsListReader
+{
+public:
+    explicit CapsListReader(JNIEnv* env) : mEnv(env)
     {
-        if (env->ExceptionCheck())
-            env->ExceptionClear();
-        return;
+        mCollection = find("java/util/Collection");
+        mNumber = find("java/lang/Number");
+        mIntArray = find("[I");
+        mObjectArray = find("[Ljava/lang/Object;");
+        if (mCollection)
+            mToArray = get_method_or_null(env, mCollection, "toArray", "()[Ljava/lang/Object;");
+        if (mNumber)
+            mIntValue = get_method_or_null(env, mNumber, "intValue", "()I");
     }
 
-    // Best-effort: match the common slow-motion preview size seen in logs (HD).
-    const jint w = 1280;
-    const jint h = 720;
-    const jint fps = 960;
-    env->CallVoidMethod(capsObj, mid, w, h, fps);
-    if (env->ExceptionCheck())
+    ~CapsListReader()
     {
-        env->ExceptionClear();
-        return;
+        for (jclass c : {mCollection, mNumber, mIntArray, mObjectArray})
+        {
+            if (c)
+                mEnv->DeleteLocalRef(c);
+        }
     }
 
-    // Required tokens for validation.
-    ALOGE("SLOW_MOTION framerate:960 injected_hfr=1 w=%d h=%d", (int)w, (int)h);
-}
+    void readEntries(jobject owner, jfieldID fid, std::vector<SlowMotionEntry>& out)
+    {
+        jobject value = fid ? mEnv->GetObjectField(owner, fid) : nullptr;
+        if (!value)
+        {
+            jni_failed(mEnv);
+            return;
+        }
+        if (mIntArray && mEnv->IsInstanceOf(value, mIntArray))
+        {
+            std::vector<jint> v = ints(static_cast<jintArray>(value));
+            for (size_t i = 0; i + 3 <= v.size(); i += 3)
+                out.push_back({v[i], v[i + 1], v[i + 2], 0});
+        }
+        else if (jobjectArray elems = elements(value))
+        {
+            const jsize n = mEnv->GetArrayLength(elems);
+            for (jsize i = 0; i < n; i++)
+            {
+                jobject e = mEnv->GetObjectArrayElement(elems, i);
+                SlowMotionEntry entry{0, 0, 0, 0};
+                if (e && entry_of(e, entry))
+                    out.push_back(entry);
+                jni_failed(mEnv);
+                if (e)
+                    mEnv->DeleteLocalRef(e);
+            }
+            mEnv->DeleteLocalRef(elems);
+        }
+        mEnv->DeleteLocalRef(value);
+    }
 
-static void inject_super_slow_960(JNIEnv* env, jobject capsObj)
-{
-    if (!env || !capsObj)
-        return;
+    void readInts(jobject owner, jfieldID fid, std::vector<jint>& out)
+    {
+        jobject value = fid ? mEnv->GetObjectField(owner, fid) : nullptr;
+        if (!value)
+        {
+            jni_failed(mEnv);
+            return;
+        }
+        if (mIntArray && mEnv->IsInstanceOf(value, mIntArray))
+        {
+            std::vector<jint> v = ints(static_cast<jintArray>(value));
+            out.insert(out.end(), v.begin(), v.end());
+        }
+        else if (jobjectArray elems = elements(value))
+        {
+            const jsize n = mEnv->GetArrayLength(elems);
+            for (jsize i = 0; i < n; i++)
+            {
+                jobject e = mEnv->GetObjectArrayElement(elems, i);
+                if (e && mNumber && mIntValue && mEnv->IsInstanceOf(e, mNumber))
+                {
+                    const jint x = mEnv->CallIntMethod(e, mIntValue);
+                    if (!jni_failed(mEnv))
+                        out.push_back(x);
+                }
+                jni_failed(mEnv);
+                if (e)
+                    mEnv->DeleteLocalRef(e);
+            }
+            mEnv->DeleteLocalRef(elems);
+        }
+        mEnv->DeleteLocalRef(value);
+    }
 
-    jclass cls = env->GetObjectClass(capsObj);
-    if (!cls)
-        return;
+private:
+    jclass find(const char* name)
+    {
+        jclass c = mEnv->FindClass(name);
+        jni_failed(mEnv);
+        return c;
+    }
 
-    jmethodID midSetMode = env->GetMethodID(cls, "setSuperSlowMode", "(I)V");
-    if (!midSetMode)
+    std::vector<jint> ints(jintArray a)
     {
-        if (env->ExceptionCheck())
-            env->ExceptionClear();
-        return;
+        std::vector<jint> v((size_t)mEnv->GetArrayLength(a));
+        if (!v.empty())
+            mEnv->GetIntArrayRegion(a, 0, (jsize)v.size(), v.data());
+        if (jni_failed(mEnv))
+            v.clear();
+        return v;
     }
 
-    jmethodID midAddInfo = env->GetMethodID(cls, "addSuperSlowSupportedInfo", "(III)V");
-    if (!midAddInfo)
+    // Local Object[] for a Collection or Object[] value, or nullptr.
+    jobjectArray elements(jobject value)
     {
-        if (env->ExceptionCheck())
-            env->ExceptionClear();
-        return;
+        jobjectArray a = nullptr;
+        if (mCollection && mToArray && mEnv->IsInstanceOf(value, mCollection))
+            a = static_cast<jobjectArray>(mEnv->CallObjectMethod(value, mToArray));
+        else if (mObjectArray && mEnv->IsInstanceOf(value, mObjectArray))
+            a = static_cast<jobjectArray>(mEnv->NewLocalRef(value));
+        if (jni_failed(mEnv))
+            return nullptr;
+        return a;
     }
 
-    jmethodID midAddFrame = env->GetMethodID(cls, "addSuperSlowFrameNum", "(I)V");
-    if (!midAddFrame)
+    bool entry_of(jobject e, SlowMotionEntry& out)
     {
-        if (env->ExceptionCheck())
-            env->ExceptionClear();
-        return;
+        if (mIntArray && mEnv->IsInstanceOf(e, mIntArray))
+        {
+            std::vector<jint> v = ints(static_cast<jintArray>(e));
+            if (v.size() < 3)
+                return false;
+            out = {v[0], v[1], v[2], 0};
+            return true;
+        }
+
+        static const char* const kWidth[] = {"width", "mWidth", "w", "mW", "getWidth", nullptr};
+        static const char* const kHeight[] = {"height", "mHeight", "h", "mH", "getHeight", nullptr};
+        static const char* const kFps[] = {"fps", "mFps", "frameRate", "mFrameRate", "getFps", "getFrameRate", nullptr};
+        jclass cls = mEnv->GetObjectClass(e);
+        if (!cls)
+            return false;
+        const bool ok = int_member(e, cls, kWidth, out.w) && int_member(e, cls, kHeight, out.h) &&
+            int_member(e, cls, kFps, out.fps);
+        mEnv->DeleteLocalRef(cls);
+        return ok;
     }
 
-    // Best-effort: populate Capability so CameraApp can serialize it into its own cache.
-    // Dex analysis indicates SuperSlowMode ON code is 1.
-    env->CallVoidMethod(capsObj, midSetMode, (jint)1);
-    if (env->ExceptionCheck())
+    // The one of names that exists as an int field, or else the one that exists as an ()I getter (names starting
+    // with "get"). Two fields (e.g. width and mWidth), or no field and two getters, are ambiguous: nothing is read.
+    bool int_member(jobject obj, jclass cls, const char* const* names, jint& out)
     {
-        env->ExceptionClear();
-        return;
+        jfieldID fid = nullptr;
+        jmethodID mid = nullptr;
+        int fields = 0;
+        int getters = 0;
+        for (; *names; names++)
+        {
+            if (strncmp(*names, "get", 3) == 0)
+            {
+                if (jmethodID m = get_method_or_null(mEnv, cls, *names, "()I"))
+                {
+                    mid = m;
+                    getters++;
+                }
+                continue;
+            }
+            if (jfieldID f = mEnv->GetFieldID(cls, *names, "I"))
+            {
+                fid = f;
+                fields++;
+            }
+            else
+            {
+                jni_failed(mEnv);
+            }
+        }
+        if (fields == 1)
+            out = mEnv->GetIntField(obj, fid);
+        else if (fields == 0 && getters == 1)
+            out = mEnv->CallIntMethod(obj, mid);
+        else
+            return false;
+        return !jni_failed(mEnv);
     }
 
-    // Add common recording sizes to maximize matching.
-    env->CallVoidMethod(capsObj, midAddInfo, (jint)1280, (jint)720, (jint)960);
-    if (env->ExceptionCheck())
+    JNIEnv* mEnv;
+    jclass mCollection = nullptr;
+    jclass mNumber = nullptr;
+    jclass mIntArray = nullptr;
+    jclass mObjectArray = nullptr;
+    jmethodID mToArray = nullptr;
+    jmethodID mIntValue = nullptr;
+};
+
+// Completed model of what the real nativeGetCaps put into capsObj.
+static void read_slow_motion_caps(JNIEnv* env, jobject capsObj, const CapabilityBindings* caps, SlowMotionCaps& out)
+{
+    std::vector<jint> frameNums;
+    if (caps && capsObj)
     {
-        env->ExceptionClear();
+        CapsListReader reader(env);
+        reader.readEntries(capsObj, caps->hfrInfo, out.hfr);
+        reader.readEntries(capsObj, caps->superSlowInfo, out.superSlow);
+        reader.readInts(capsObj, caps->superSlowFrameNum, frameNums);
+    }
+    complete_slow_motion_caps(out, frameNums);
+}
+
+// HFR entry for the smallest super-slow size, unless the real caps already have it at that fps.
+static void inject_hfr(JNIEnv* env, jobject capsObj, const CapabilityBindings& caps, const SlowMotionCaps& model)
+{
+    jmethodID mid = caps.addHighFrameRateSupportedInfo;
+    if (!mid || model.superSlow.empty())
         return;
+
+    const SlowMotionEntry* target = &model.superSlow[0];
+    for (const SlowMotionEntry& e : model.superSlow)
+    {
+        if ((int64_t)e.w * e.h < (int64_t)target->w * target->h)
+            target = &e;
     }
-    env->CallVoidMethod(capsObj, midAddInfo, (jint)1920, (jint)1080, (jint)960);
-    if (env->ExceptionCheck())
+    for (const SlowMotionEntry& e : model.hfr)
     {
-        env->ExceptionClear();
-        return;
+        if (e.w == target->w && e.h == target->h && e.fps >= target->fps)
+            return;
     }
 
-    // Pair frameNum entries with supportedInfo entries.
-    env->CallVoidMethod(capsObj, midAddFrame, (jint)192);
+    env->CallVoidMethod(capsObj, mid, target->w, target->h, target->fps);
     if (env->ExceptionCheck())
     {
         env->ExceptionClear();
         return;
     }
-    env->CallVoidMethod(capsObj, midAddFrame, (jint)192);
+
+    // Required tokens for validation.
+    ALOGE("SLOW_MOTION framerate:%d injected_hfr=1 w=%d h=%d", (int)target->fps, (int)target->w, (int)target->h);
+}
+
+// Only needed when the real caps carry no super-slow entries; the assumed ones are added instead.
+static void inject_super_slow(JNIEnv* env, jobject capsObj, const CapabilityBindings& caps,
+                              const SlowMotionCaps& model)
+{
+    if (model.reported)
+        return;
+
+    jmethodID midSetMode = caps.setSuperSlowMode;
+    jmethodID midAddInfo = caps.addSuperSlowSupportedInfo;
+    jmethodID midAddFrame = caps.addSuperSlowFrameNum;
+    if (!midSetMode || !midAddInfo || !midAddFrame)
+        return;
+
+    // Best-effort: populate Capability so CameraApp can serialize it into its own cache.
+    // Dex analysis indicates SuperSlowMode ON code is 1.
+    env->CallVoidMethod(capsObj, midSetMode, (jint)1);
     if (env->ExceptionCheck())
     {
         env->ExceptionClear();
         return;
     }
 
-    ALOGE("WRAP: injected super-slow 960 into caps (sizes=1280x720,1920x1080 frameNum=192)");
+    for (const SlowMotionEntry& e : model.superSlow)
+    {
+        env->CallVoidMethod(capsObj, midAddInfo, e.w, e.h, e.fps);
+        if (env->ExceptionCheck())
+        {
+            env->ExceptionClear();
+            return;
+        }
+    }
+
+    // Pair frameNum entries with supportedInfo entries.
+    for (const SlowMotionEntry& e : model.superSlow)
+    {
+        env->CallVoidMethod(capsObj, midAddFrame, e.frames);
+        if (env->ExceptionCheck())
+        {
+            env->ExceptionClear();
+            return;
+        }
+    }
+
+    ALOGE("WRAP: injected super-slow %d into caps (%s)", (int)model.superSlow[0].fps,
+          format_super_slow_config(model).c_str());
 }
 
 extern "C" __attribute__((visibility("default")))
@@ -510,13 +1220,35 @@ jint Java_com_sonymobile_imageprocessor_bypasscamera2_BypassCamera_nativeGetCaps
     jint cameraIndex,
     jobject capsObj)
 {
-    ALOGE("WRAP: nativeGetCaps enter cameraIndex=%d capsObj=%p", (int)cameraIndex, capsObj);
-    Real_nativeGetCapsFn real = load_real_nativeGetCaps();
-    jint ret = real ? real(env, clazz, cameraIndex, capsObj) : -1;
+    static android::LatencyStats::Probe* const latencyProbe = android::LatencyStats::get().probe("nativeGetCaps");
+    android::LatencyScope latency(latencyProbe);
+
+    CapabilityBindings scratch;
+    const CapabilityBindings* caps = (env && capsObj) ? capability_bindings(env, capsObj, scratch) : nullptr;
+
+    Real_nativeGetCapsFn real = RealLibrary::get().fn<Real_nativeGetCapsFn>(kRealNativeGetCaps);
+    SlowMotionCaps model;
+    jint ret = -1;
+    if (real)
+    {
+        ret = android::latency_real([&] { return real(env, clazz, cameraIndex, capsObj); });
+        read_slow_motion_caps(env, capsObj, caps, model);
+        SlowMotionModel::get().update(cameraIndex, model);
+    }
+    else
+    {
+        complete_slow_motion_caps(model, std::vector<jint>());
+    }
 
     // Inject after real has populated normal caps.
-    inject_hfr_960(env, capsObj);
-    inject_super_slow_960(env, capsObj);
+    if (caps)
+    {
+        inject_hfr(env, capsObj, *caps, model);
+        inject_super_slow(env, capsObj, *caps, model);
+    }
+
+    android::wrap_trace(wraptrace::kEvNativeGetCaps, 0, __builtin_return_address(0), (uint64_t)(uint32_t)cameraIndex,
+                        0, ret);
     return ret;
 }
 
@@ -534,56 +1266,97 @@ jint Java_com_sonymobile_imageprocessor_bypasscamera2_BypassCamera_nativeChangeT
     jint fps,
     jint frameNum)
 {
+    static android::LatencyStats::Probe* const latencyProbe =
+        android::LatencyStats::get().probe("nativeChangeToSuperSlowMode");
+    android::LatencyScope latency(latencyProbe);
+
     // This method is called when switching into SUPER_SLOW mode.
-    // Log tokens used by the automated validation.
-    ALOGE(
-        "WRAP: nativeChangeToSuperSlowMode enter mode=%d record=%dx%d video=%dx%d param8=%d fps=%d frameNum=%d",
-        (int)superSlowMode,
-        (int)recordW,
-        (int)recordH,
-        (int)videoW,
-        (int)videoH,
-        (int)param8,
-        (int)fps,
-        (int)frameNum);
+    // fps == 0 ("mSuperSlowFps cannot be 0" crash path) is filled from the capability model; when the real
+    // caps reported super-slow entries, fps / frame count beyond them are clamped so the reconfigure does not fail
+    // or drop frames on sensors that cannot sustain the requested rate. Sizes are never rewritten: Java keeps
+    // using the size it asked for, so a record size the caps do not list is refused instead of switched to another.
+    const SlowMotionCaps model = SlowMotionModel::get().active();
+    bool exact = false;
+    const SlowMotionEntry entry = pick_super_slow_entry(model, recordW, recordH, &exact);
+    if (model.reported && superSlowMode != 0 && !exact)
+    {
+        ALOGE("WRAP: super-slow record %dx%d is not in the reported caps (nearest %dx%d@%d), rejecting",
+              (int)recordW, (int)recordH, (int)entry.w, (int)entry.h, (int)entry.fps);
+        android::wrap_trace(wraptrace::kEvSuperSlowMode, 0, __builtin_return_address(0),
+                            ((uint64_t)(uint32_t)fps << 32) | (uint32_t)frameNum, 0, -1);
+        return -1;
+    }
 
     jint patchedFps = fps;
     jint patchedFrameNum = frameNum;
     if (patchedFps == 0)
     {
-        // Best-effort: avoid the known crash path "mSuperSlowFps cannot be 0".
-        // If the Java-side capability cache is incomplete, try forcing 960.
-        patchedFps = 960;
+        patchedFps = entry.fps;
         if (patchedFrameNum == 0)
-            patchedFrameNum = 192;
+            patchedFrameNum = entry.frames;
+    }
+    if (model.reported && superSlowMode != 0)
+    {
+        if (patchedFps > entry.fps)
+            patchedFps = entry.fps;
+        if (patchedFrameNum > entry.frames)
+            patchedFrameNum = entry.frames;
+    }
+
+    // Log tokens used by the automated validation.
+    if (patchedFps != fps || patchedFrameNum != frameNum)
+    {
         ALOGE(
-            "SLOW_MOTION framerate:960 injected_superSlow=1 record=%dx%d video=%dx%d frameNum=%d",
+            "SLOW_MOTION framerate:%d injected_superSlow=1 record=%dx%d video=%dx%d frameNum=%d",
+            (int)patchedFps,
             (int)recordW,
             (int)recordH,
             (int)videoW,
             (int)videoH,
             (int)patchedFrameNum);
     }
-    else
+    else if (patchedFps == kSuperSlowDefaultFps)
     {
         // Still emit the validation-friendly token when the real fps is 960.
-        if (patchedFps == 960)
-        {
-            ALOGE(
-                "SLOW_MOTION framerate:960 injected_superSlow=0 record=%dx%d video=%dx%d frameNum=%d",
-                (int)recordW,
-                (int)recordH,
-                (int)videoW,
-                (int)videoH,
-                (int)patchedFrameNum);
-        }
+        ALOGE(
+            "SLOW_MOTION framerate:960 injected_superSlow=0 record=%dx%d video=%dx%d frameNum=%d",
+            (int)recordW,
+            (int)recordH,
+            (int)videoW,
+            (int)videoH,
+            (int)patchedFrameNum);
     }
 
-    Real_nativeChangeToSuperSlowModeFn real = load_real_nativeChangeToSuperSlowMode();
-    if (!real)
-        return -1;
+    // Start reserving the burst buffers before the real switch so they are ready by the first 960 fps frame.
+    if (superSlowMode != 0)
+        request_burst_reservation(recordW, recordH, videoW, videoH, patchedFrameNum);
+    else
+        request_burst_reservation(0, 0, 0, 0, 0);
 
-    return real(env, thiz, nativePtr, superSlowMode, recordW, recordH, videoW, videoH, param8, patchedFps, patchedFrameNum);
+    Real_nativeChangeToSuperSlowModeFn real =
+        RealLibrary::get().fn<Real_nativeChangeToSuperSlowModeFn>(kRealNativeChangeToSuperSlowMode);
+    jint ret = -1;
+    if (real)
+    {
+        ret = android::latency_real([&] {
+            return real(env, thiz, nativePtr, superSlowMode, recordW, recordH, videoW,
+                        videoH, param8, patchedFps, patchedFrameNum);
+        });
+    }
+    if (ret != 0 && superSlowMode != 0)
+        request_burst_reservation(0, 0, 0, 0, 0);
+
+    // Late/dropped frames on shim Surfaces are counted against the rate actually switched to, and only while
+    // super-slow is active; 0 turns the check off again (preview and normal video are not paced).
+    android::FramePacing::setTargetFps((ret == 0 && superSlowMode != 0) ? patchedFps : 0);
+
+    // The per-call enter log moved to the binary trace ring (see common/wrap_trace.h).
+    const bool patched = patchedFps != fps || patchedFrameNum != frameNum;
+    const uint16_t tflags = patched ? wraptrace::kFlagPatched : 0;
+    android::wrap_trace(wraptrace::kEvSuperSlowMode, tflags, __builtin_return_address(0),
+                        ((uint64_t)(uint32_t)fps << 32) | (uint32_t)frameNum,
+                        ((uint64_t)(uint32_t)patchedFps << 32) | (uint32_t)patchedFrameNum, ret);
+    return ret;
 }
 
 // 3-arg ctor（系統 libgui.so 內有的符號）
@@ -615,6 +1388,7 @@ _ZN7android7SurfaceC1ERKNS_2spINS_22IGraphicBufferProducerEEEb(android::Surface*
                                                               bool controlledByApp) {
     sp<android::IBinder> nullHandle;
     Surface_ctor3_C1(thiz, bp, controlledByApp, nullHandle);
+    android::FramePacing::maybeInstall(static_cast<ANativeWindow*>(thiz), "imageprocessorjni");
 }
 
 extern "C" void
@@ -623,4 +1397,5 @@ _ZN7android7SurfaceC2ERKNS_2spINS_22IGraphicBufferProducerEEEb(android::Surface*
                                                               bool controlledByApp) {
     sp<android::IBinder> nullHandle;
     Surface_ctor3_C2(thiz, bp, controlledByApp, nullHandle);
+    android::FramePacing::maybeInstall(static_cast<ANativeWindow*>(thiz), "imageprocessorjni");
 }
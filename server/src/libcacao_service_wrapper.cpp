@@ -1,13 +1,54 @@
+#include <dlfcn.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <mutex>
+
 #include <binder/IMemory.h>
+#include <binder/IPCThreadState.h>
+#include <log/log.h>
 #include <utils/StrongPointer.h>
 
 #include "alloc_fix.h"
+#include "caps_region.h"
+#include "latency_hist.h"
+#include "wrap_trace.h"
+
+namespace cacao
+{
+    namespace ProcessCtrlCaps
+    {
+        struct CameraIndex;
+    }
+    namespace ISerialize
+    {
+        // getCaps 值傳的 blob；內容 wrapper 不解讀，只需要大小跟傳法對
+        // arm（prebuilts/lib/libcacao_client_real.so，BnCacaoService::onTransact 0xd166..0xd188）：
+        //   從 vtable +24 取 getCaps，把 &data+4 起的 400 bytes 逐 word 複製到 sp，r3 = 第一個 word，直接 blx；
+        //   前後沒有 copy ctor / dtor 呼叫，所以是 trivially copyable、0x194 bytes、4-byte 對齊
+        //   （real CacaoService::getCaps 0xa25c 的 prologue 先 sub sp,#4 把 r3 存回 stack 引數前面，對得上）
+        // arm64：Cacao::getCaps memset / 複製的都是 0x198，+392 放 IMemory 指標所以是 8-byte 對齊；
+        //   超過 16 bytes 的值傳 struct 由 caller 複製一份傳指標，大小只影響這邊 copy 多少
+        struct SerializedData
+        {
+#if defined(__LP64__)
+            alignas(8) uint8_t bytes[0x198];
+#else
+            alignas(4) uint8_t bytes[0x194];
+#endif
+        };
+    }
+}
 
 namespace android
 {
     class CacaoService
     {
     public:
+        int getCaps(const cacao::ProcessCtrlCaps::CameraIndex &idx, const android::sp<android::IMemory> &mem,
+                    cacao::ISerialize::SerializedData data);
+
         class Client
         {
         public:
@@ -16,9 +57,115 @@ namespace android
     };
 }
 
+struct ServiceAllocPolicy : android::AllocPolicyDefaults
+{
+    static constexpr const char *kWho = "CacaoService::Client::allocMemory";
+    static constexpr bool kArena = true;
+    static constexpr bool kMemfdSwitch = true;
+    static constexpr bool kQuota = true;
+};
+
 __attribute__((visibility("default")))
 android::sp<android::IMemory>
 android::CacaoService::Client::allocMemory(unsigned int size)
 {
-    return android::allocMemory_common(size, "CacaoService::Client::allocMemory");
+    // 依 calling pid 分組：arena（對端 map 的是整個 heap，不同 client 不能共用）跟 ClientQuota 的帳
+    const int owner = (int)android::IPCThreadState::self()->getCallingPid();
+    return android::allocMemory_common<ServiceAllocPolicy>(size, __builtin_return_address(0), owner);
+}
+
+// trace ring dump：輸出格式見 common/wrap_trace_format.h，用 wrap_trace_decode 解
+extern "C" __attribute__((visibility("default")))
+int libcacao_service_wrapper_trace_dump(int fd)
+{
+    return android::WrapTrace::get().dump(fd);
+}
+
+// 大 allocation prefault 的累計：out 依序 count / bytes / minflt / ns，回傳填了幾個
+extern "C" __attribute__((visibility("default")))
+size_t libcacao_service_wrapper_prefault_stats(uint64_t *out, size_t n)
+{
+    return android::prefault_stats_read(out, n);
+}
+
+// 依 who tag 的 live allocation 統計（文字，一個 tag 一行；欄位見第一行）
+extern "C" __attribute__((visibility("default")))
+int libcacao_service_wrapper_alloc_stats_dump(int fd)
+{
+    return android::AllocStats::get().dump(fd);
+}
+
+// 各 entry point 的 latency 分佈（文字，一行一條 histogram；見 common/latency_hist.h）
+extern "C" __attribute__((visibility("default")))
+int libcacao_service_wrapper_latency_dump(int fd)
+{
+    return android::LatencyStats::get().dump(fd);
+}
+
+// 依 client（pid）的 shared-memory 額度使用狀況（見 common/client_quota.h）
+extern "C" __attribute__((visibility("default")))
+int libcacao_service_wrapper_quota_dump(int fd)
+{
+    return android::ClientQuota::get().dump(fd);
+}
+
+// ---------- 跨 process caps 區塊（格式見 common/caps_region.h）----------
+// CacaoService 的 vtable 對 getCaps 是 R_ARM_ABS32 symbol relocation，所以這裡的定義會蓋掉 real.so 的；
+// 照原本呼叫 real，成功後把 (CameraIndex, 收到的 blob, service 填好的 shared memory) 發佈到區塊，
+// 其他 process 的 client 唯讀 map 後就不必再走 binder。
+// 區塊預設關著（要 SELinux / 檔案 group 另外設好，見 caps_region.h），關著時只多一次 static bool 判斷。
+using RealGetCapsFn = int (*)(android::CacaoService *, const cacao::ProcessCtrlCaps::CameraIndex &,
+                              const android::sp<android::IMemory> &, cacao::ISerialize::SerializedData);
+
+static android::CapsRegion *caps_region_writer()
+{
+    static android::CapsRegion *region = []() -> android::CapsRegion *
+    {
+        android::CapsRegion *r = new android::CapsRegion();
+        if (r->openWriter(android::CapsRegion::path(), android::get_build_fingerprint()))
+            return r;
+        ALOGE("WRAP: caps region open failed path=%s", android::CapsRegion::path().c_str());
+        delete r;
+        return nullptr;
+    }();
+    return region;
+}
+
+// 發佈的是 service 填好的 payload；data 裡是 client 的 mem 指標，對別的 process 沒意義，不發佈
+static void publish_caps(const cacao::ProcessCtrlCaps::CameraIndex &idx, const android::sp<android::IMemory> &mem)
+{
+    static std::mutex lock;
+    std::lock_guard<std::mutex> _l(lock);
+    android::CapsRegion *region = caps_region_writer();
+    if (!region)
+        return;
+    // CameraIndex 只有前向宣告；real.so 裡是包一個 int 的 struct，取前 4 bytes 當 key（跟 client 端一樣）
+    int32_t key = 0;
+    memcpy(&key, &idx, sizeof(key));
+    const void *pp = mem != nullptr ? mem->unsecurePointer() : nullptr;
+    if (pp)
+        (void)region->publish(key, pp, mem->size());
+}
+
+__attribute__((visibility("default")))
+int android::CacaoService::getCaps(const cacao::ProcessCtrlCaps::CameraIndex &idx,
+                                   const android::sp<android::IMemory> &mem, cacao::ISerialize::SerializedData data)
+{
+    static const RealGetCapsFn real = []() -> RealGetCapsFn
+    {
+        // real.so 是這個 library 的 NEEDED，已經載入了
+        void *h = dlopen("libcacao_service_real.so", RTLD_NOW | RTLD_NOLOAD);
+        void *sym = h ? dlsym(h, "_ZN7android12CacaoService7getCapsERKN5cacao15ProcessCtrlCaps11CameraIndexERKNS_"
+                                 "2spINS_7IMemoryEEENS1_10ISerialize14SerializedDataE")
+                      : nullptr;
+        if (!sym)
+            ALOGE("WRAP: CacaoService::getCaps real symbol missing: %s", dlerror());
+        return reinterpret_cast<RealGetCapsFn>(sym);
+    }();
+    if (!real)
+        return -1;
+    const int r = real(this, idx, mem, data);
+    if (r == 0 && android::CapsRegion::enabled())
+        publish_caps(idx, mem);
+    return r;
 }
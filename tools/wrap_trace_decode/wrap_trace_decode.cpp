@@ -0,0 +1,114 @@
+// host 端解 <lib>_wrapper_trace_dump(fd) 的輸出
+// 用法：wrap_trace_decode <dump 檔>（省略或 "-" 讀 stdin）
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "wrap_trace_format.h"
+
+static void print_event(const wraptrace::Event& e, int64_t t0)
+{
+    const double ms = (double)(e.ts_ns - t0) / 1e6;
+    printf("%12.3f pid=%d tid=%d %-28s flags=0x%02x ra=0x%" PRIx64, ms, e.pid, e.tid,
+           wraptrace::event_name(e.event), (unsigned)e.flags, e.ra);
+
+    switch (e.event)
+    {
+        case wraptrace::kEvAlloc:
+        case wraptrace::kEvAllocReject:
+            printf(" raw=%" PRIu64 "(0x%" PRIx64 ") fixed=%" PRIu64, e.raw, e.raw, e.fixed);
+            break;
+        case wraptrace::kEvGetCaps:
+            printf(" raw=%" PRIu64, e.raw);
+            break;
+        case wraptrace::kEvNativeGetCaps:
+            printf(" cameraIndex=%d", (int)(uint32_t)e.raw);
+            break;
+        case wraptrace::kEvSuperSlowMode:
+            printf(" fps=%d frameNum=%d -> fps=%d frameNum=%d", (int)(uint32_t)(e.raw >> 32), (int)(uint32_t)e.raw,
+                   (int)(uint32_t)(e.fixed >> 32), (int)(uint32_t)e.fixed);
+            break;
+        case wraptrace::kEvPrefault:
+            printf(" bytes=%" PRIu64 " minflt=%" PRIu64 " us=%.1f", e.raw, e.fixed, (double)e.result / 1e3);
+            break;
+        case wraptrace::kEvScatter:
+            printf(" total=%" PRIu64 " chunks=%" PRIu64, e.raw, e.fixed);
+            break;
+        case wraptrace::kEvBurstReserve:
+            printf(" frameBytes=%u frames=%u reserved=%" PRIu64, (unsigned)(e.raw >> 32), (unsigned)(uint32_t)e.raw,
+                   e.fixed);
+            break;
+        case wraptrace::kEvFrameLate:
+            printf(" interval_us=%.1f target_fps=%u missed=%u queue_us=%.1f", (double)e.raw / 1e3,
+                   (unsigned)(e.fixed >> 32), (unsigned)(uint32_t)e.fixed, (double)e.result / 1e3);
+            break;
+        default:
+            printf(" raw=0x%" PRIx64 " fixed=0x%" PRIx64, e.raw, e.fixed);
+            break;
+    }
+
+    if (e.flags & wraptrace::kFlagHiFF)
+        printf(" hi_ff");
+    if (e.flags & wraptrace::kFlagCapsPath)
+        printf(" caps_path");
+    if (e.flags & wraptrace::kFlagClampMin)
+        printf(" clamp_min");
+    if (e.flags & wraptrace::kFlagFresh)
+        printf(" fresh");
+    if (e.flags & wraptrace::kFlagPatched)
+        printf(" patched");
+    if (e.flags & wraptrace::kFlagArena)
+        printf(" arena");
+    if (e.flags & wraptrace::kFlagQuota)
+        printf(" quota");
+    printf(" result=%" PRId64 "\n", e.result);
+}
+
+int main(int argc, char** argv)
+{
+    FILE* f = stdin;
+    if (argc > 1 && strcmp(argv[1], "-") != 0)
+    {
+        f = fopen(argv[1], "rb");
+        if (!f)
+        {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    wraptrace::FileHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != wraptrace::kMagic)
+    {
+        fprintf(stderr, "not a wrap trace dump\n");
+        return 1;
+    }
+    if (hdr.version != wraptrace::kVersion || hdr.event_size != sizeof(wraptrace::Event))
+    {
+        fprintf(stderr, "unsupported dump version=%u event_size=%u\n", hdr.version, hdr.event_size);
+        return 1;
+    }
+
+    // count == 0 表示 dump 時 fd 不能 seek，讀到 EOF 為止
+    std::vector<wraptrace::Event> events;
+    wraptrace::Event e;
+    while ((hdr.count == 0 || events.size() < hdr.count) && fread(&e, sizeof(e), 1, f) == 1)
+        events.push_back(e);
+    if (f != stdin)
+        fclose(f);
+
+    std::stable_sort(events.begin(), events.end(),
+                     [](const wraptrace::Event& a, const wraptrace::Event& b) { return a.ts_ns < b.ts_ns; });
+
+    const int64_t t0 = events.empty() ? 0 : events.front().ts_ns;
+    for (const auto& ev : events)
+        print_event(ev, t0);
+
+    fprintf(stderr, "%zu events\n", events.size());
+    return 0;
+}